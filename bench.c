@@ -0,0 +1,429 @@
+/*
+ * dhcpd.conf text user interface editor, benchmark
+ * Copyright (C) 2018  Victor C. Salas P. (aka nmag) <nmagko@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* The editor is built in without its main, so every benchmark runs the
+ * very same code without dialog.  All files live in a directory made
+ * for the run, backups and the model cache included.
+ */
+#define _BENCH
+#include "dhcpdtui.c"
+#include <ftw.h>
+#include <sys/resource.h>
+
+#define BENCH_RUNS  5
+#define BENCH_ADDRS 1048576  /* addresses parsed and formatted in a run */
+#define BENCH_EDITS 1000     /* host edits stepped back and forth */
+
+/* Shape of a generated dhcpd.conf. */
+struct gen_opts {
+  long subnets, hosts;   /* hosts in each subnet */
+  long ranges, options;  /* in each subnet */
+  int shared;            /* everything inside one shared-network */
+};
+
+static const char *gen_option[] = {
+  "option routers %s",
+  "option broadcast-address %s",
+  "option domain-name-servers 10.255.255.1, 10.255.255.2",
+  "option ntp-servers 10.255.255.3",
+  "option domain-name \"site%li.example.com\"",
+  "default-lease-time 600",
+  "max-lease-time 7200",
+  "option subnet-mask %s",
+  NULL
+};
+
+static char *gen_ip (char *s, uint32_t ip) {
+  sprintf(s, "%u.%u.%u.%u", ip >> 24, ( ip >> 16 ) & 0xff, ( ip >> 8 ) & 0xff, ip & 0xff);
+  return s;
+}
+
+/* Write a configuration to out: subnets are blocks of 10.0.0.0/8 wide
+ * enough for their hosts and ranges, hosts get unique MAC addresses.
+ */
+static int generate (FILE *out, struct gen_opts *go) {
+  uint32_t block, net, ip;
+  uint64_t mac = 0x020000000000ULL;
+  char network[16], netmask[16], addr[16], last[16], text[64];
+  const char *indent = go->shared ? "  " : "";
+  long s, h, i, nopts;
+  for ( nopts = 0; gen_option[nopts] != NULL; nopts++ )
+    ;
+  for ( block = 256; block < (uint32_t) ( 16 + go->hosts + 8 * go->ranges ); block *= 2 )
+    if ( block >= ( 1U << 23 ) )
+      return EXIT_FAILURE;
+  if ( (uint64_t) go->subnets * block > ( 1U << 24 ) )
+    return EXIT_FAILURE;
+  fprintf(out,
+	  "# %s: dhcpd.conf generated, %li subnets of %li hosts\n"
+	  "authoritative;\n"
+	  "ddns-update-style none;\n"
+	  "default-lease-time 600;\n"
+	  "max-lease-time 7200;\n"
+	  "log-facility local7;\n"
+	  "option domain-name \"example.com\";\n",
+	  program_invocation_short_name, go->subnets, go->hosts);
+  if ( go->shared )
+    fprintf(out, "shared-network bench {\n");
+  for ( s = 0; s < go->subnets; s++ ) {
+    net = ( 10U << 24 ) + s * block;
+    gen_ip(network, net);
+    gen_ip(netmask, ~( block - 1 ));
+    fprintf(out, "%ssubnet %s netmask %s {\n", indent, network, netmask);
+    for ( i = 0; i < go->options; i++ ) {
+      fprintf(out, "%s  ", indent);
+      switch (i % nopts) {
+      case 0 :
+	fprintf(out, gen_option[0], gen_ip(addr, net + 1));
+	break;
+      case 1 :
+	fprintf(out, gen_option[1], gen_ip(addr, net + block - 1));
+	break;
+      case 4 :
+	fprintf(out, gen_option[4], s);
+	break;
+      case 7 :
+	fprintf(out, gen_option[7], netmask);
+	break;
+      default :
+	fputs(gen_option[i % nopts], out);
+      }
+      fprintf(out, ";\n");
+    }
+    for ( i = 0; i < go->ranges; i++ ) {
+      ip = net + block - 2 - 8 * ( go->ranges - i );
+      fprintf(out, "%s  range %s %s;\n", indent, gen_ip(addr, ip + 1), gen_ip(last, ip + 8));
+    }
+    for ( h = 0; h < go->hosts; h++, mac++ ) {
+      snprintf(text, sizeof(text), "host-%li-%li", s, h);
+      fprintf(out, "%s  host %s {\n", indent, text);
+      fprintf(out, "%s    hardware ethernet %02x:%02x:%02x:%02x:%02x:%02x;\n", indent,
+	      (unsigned) ( mac >> 40 ) & 0xff, (unsigned) ( mac >> 32 ) & 0xff,
+	      (unsigned) ( mac >> 24 ) & 0xff, (unsigned) ( mac >> 16 ) & 0xff,
+	      (unsigned) ( mac >> 8 ) & 0xff, (unsigned) mac & 0xff);
+      fprintf(out, "%s    fixed-address %s;\n", indent, gen_ip(addr, net + 16 + h));
+      if ( h % 4 == 0 )
+	fprintf(out, "%s    option host-name \"%s\";\n", indent, text);
+      fprintf(out, "%s  }\n", indent);
+    }
+    fprintf(out, "%s}\n", indent);
+  }
+  if ( go->shared )
+    fprintf(out, "}\n");
+  return ferror(out) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static double elapsed (struct timespec *t0) {
+  struct timespec t1;
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  return ( t1.tv_sec - t0->tv_sec ) + ( t1.tv_nsec - t0->tv_nsec ) / 1e9;
+}
+
+static long peak_rss (void) {
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_maxrss;
+}
+
+static int double_cmp (const void *a, const void *b) {
+  double x = *(const double *) a, y = *(const double *) b;
+  return ( x > y ) - ( x < y );
+}
+
+/* One result line, key=value pairs so scripts can pick the fields. */
+static void report (const char *name, double *sec, int runs) {
+  qsort(sec, runs, sizeof(double), double_cmp);
+  printf("bench=%s runs=%i min=%.6f median=%.6f max=%.6f peak_rss_kb=%li\n",
+	 name, runs, sec[0], sec[runs / 2], sec[runs - 1], peak_rss());
+  fflush(stdout);
+}
+
+static void drop_model (const char *filename) {
+  char *path;
+  asprintf(&path, "%s" STORE_SUFFIX "/" MODEL_NAME, filename);
+  unlink(path);
+  free(path);
+}
+
+static int rmtree_entry (const char *path, const struct stat *sb, int flag, struct FTW *ftw) {
+  return remove(path);
+}
+
+static int bench_copy (const char *from, const char *to) {
+  FILE *in, *out;
+  char buf[BUFSIZ];
+  size_t n;
+  int rc = EXIT_SUCCESS;
+  if ( ( in = fopen(from, "r") ) == NULL )
+    return EXIT_FAILURE;
+  if ( ( out = fopen(to, "w") ) == NULL ) {
+    fclose(in);
+    return EXIT_FAILURE;
+  }
+  while ( ( n = fread(buf, 1, sizeof(buf), in) ) > 0 )
+    if ( fwrite(buf, 1, n, out) != n )
+      rc = EXIT_FAILURE;
+  if ( ferror(in) )
+    rc = EXIT_FAILURE;
+  fclose(in);
+  if ( fclose(out) != 0 )
+    rc = EXIT_FAILURE;
+  return rc;
+}
+
+int main (int argc, char *argv[]) {
+  struct gen_opts go = { 100, 100, 1, 3, 0 };
+  struct dhcpd_conf *config;
+  struct dhcpd_subnet *sn;
+  struct dhcpd_host *ho;
+  struct timespec t;
+  struct stat sb;
+  char dir[] = "/tmp/dhcpdtui-bench.XXXXXX";
+  char *filename, (*macs)[18], (*ips)[16], macbuf[18], ipbuf[16];
+  uint64_t mac, sum = 0, seed = 88172645463325252ULL;
+  uint32_t ip;
+  double *sec;
+  int runs = BENCH_RUNS, gen_only = 0, menusz, opt, r, fdes, rc = EXIT_SUCCESS;
+  long i, nhosts, bad = 0;
+  FILE *out;
+
+  while ( ( opt = getopt(argc, argv, "gs:n:r:o:wc:j:") ) != -1 ) {
+    switch (opt) {
+    case 'g' :
+      gen_only = 1;
+      break;
+    case 's' :
+      go.subnets = atol(optarg);
+      break;
+    case 'n' :
+      go.hosts = atol(optarg);
+      break;
+    case 'r' :
+      go.ranges = atol(optarg);
+      break;
+    case 'o' :
+      go.options = atol(optarg);
+      break;
+    case 'w' :
+      go.shared = 1;
+      break;
+    case 'c' :
+      runs = atoi(optarg);
+      break;
+    case 'j' :
+      worker_threads = atoi(optarg);
+      break;
+    default :
+      fprintf(stderr, "usage: %s [-g] [-s subnets] [-n hosts] [-r ranges] [-o options] [-w]"
+	      " [-c runs] [-j threads] [dhcpd.conf]\n", program_invocation_short_name);
+      exit (EXIT_FAILURE);
+    }
+  }
+  if ( go.subnets < 1 || go.hosts < 0 || go.ranges < 0 || go.options < 0 || runs < 1 ) {
+    fprintf(stderr, "%s: bad numbers\n", program_invocation_short_name);
+    exit (EXIT_FAILURE);
+  }
+  if ( gen_only ) {
+    if ( generate(stdout, &go) != EXIT_SUCCESS ) {
+      fprintf(stderr, "%s: no room for it in 10.0.0.0/8\n", program_invocation_short_name);
+      exit (EXIT_FAILURE);
+    }
+    exit (EXIT_SUCCESS);
+  }
+
+  if ( mkdtemp(dir) == NULL ) {
+    perror(dir);
+    exit (EXIT_FAILURE);
+  }
+  asprintf(&filename, "%s/" DEFNAME, dir);
+  model_config = filename;
+  if ( optind < argc ) {
+    if ( bench_copy(argv[optind], filename) != EXIT_SUCCESS ) {
+      perror(argv[optind]);
+      rc = EXIT_FAILURE;
+    }
+  } else if ( ( out = fopen(filename, "w") ) == NULL || generate(out, &go) != EXIT_SUCCESS ||
+	      fclose(out) != 0 ) {
+    fprintf(stderr, "%s: can't generate %s\n", program_invocation_short_name, filename);
+    rc = EXIT_FAILURE;
+  }
+  if ( rc == EXIT_SUCCESS ) {
+    sec = xmalloc(sizeof(double) * runs);
+    stat(filename, &sb);
+    config = get_dhcpd_config(filename);
+    printf("# %s: subnets=%li hosts=%li bytes=%li threads=%i\n", program_invocation_short_name,
+	   config->nsubnets, config->nhosts, (long) sb.st_size, worker_count());
+    nhosts = config->nhosts;
+    destroy_conf(config);
+
+    /* text parse, the model cache dropped before each run */
+    for ( r = 0; r < runs; r++ ) {
+      drop_model(filename);
+      clock_gettime(CLOCK_MONOTONIC, &t);
+      config = get_dhcpd_config(filename);
+      sec[r] = elapsed(&t);
+      destroy_conf(config);
+    }
+    report("load", sec, runs);
+
+    /* the model cache left by the last run */
+    for ( r = 0; r < runs; r++ ) {
+      clock_gettime(CLOCK_MONOTONIC, &t);
+      config = get_dhcpd_config(filename);
+      sec[r] = elapsed(&t);
+      if ( ! last_load.model )
+	rc = EXIT_FAILURE;
+      destroy_conf(config);
+    }
+    report("load_cached", sec, runs);
+
+    config = get_dhcpd_config(filename);
+    for ( r = 0; r < runs; r++ ) {
+      clock_gettime(CLOCK_MONOTONIC, &t);
+      if ( save_dhcpd_config(filename, config) != EXIT_SUCCESS )
+	rc = EXIT_FAILURE;
+      sec[r] = elapsed(&t);
+    }
+    destroy_conf(config);
+    report("save", sec, runs);
+
+    /* parse, save and parse again what was saved */
+    for ( r = 0; r < runs; r++ ) {
+      drop_model(filename);
+      clock_gettime(CLOCK_MONOTONIC, &t);
+      config = get_dhcpd_config(filename);
+      if ( save_dhcpd_config(filename, config) != EXIT_SUCCESS )
+	rc = EXIT_FAILURE;
+      destroy_conf(config);
+      drop_model(filename);
+      config = get_dhcpd_config(filename);
+      sec[r] = elapsed(&t);
+      if ( config->nhosts != nhosts )
+	rc = EXIT_FAILURE;
+      destroy_conf(config);
+    }
+    report("roundtrip", sec, runs);
+
+    /* the subnet menu and the host menu of every subnet */
+    config = get_dhcpd_config(filename);
+    for ( r = 0; r < runs; r++ ) {
+      clock_gettime(CLOCK_MONOTONIC, &t);
+      arena_reset(&scratch);
+      subnet_fast_menu(&menusz, config);
+      for ( i = 0; i < config->sorted.count; i++ )
+	host_fast_menu(&menusz, config->sorted.subnet[i]);
+      sec[r] = elapsed(&t);
+    }
+    report("menus", sec, runs);
+
+    /* both export formats to /dev/null */
+    if ( ( fdes = open("/dev/null", O_WRONLY) ) == -1 ) {
+      rc = EXIT_FAILURE;
+    } else {
+      for ( r = 0; r < runs; r++ ) {
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	if ( export_config(config, 0, fdes) != EXIT_SUCCESS || export_config(config, 1, fdes) != EXIT_SUCCESS )
+	  rc = EXIT_FAILURE;
+	sec[r] = elapsed(&t);
+      }
+      close(fdes);
+      report("export", sec, runs);
+    }
+
+    /* every edit undone, then redone */
+    for ( i = 0; i < BENCH_EDITS && config->sorted.count > 0; i++ ) {
+      sn = config->sorted.subnet[i % config->sorted.count];
+      if ( ( ho = sn->hosts ) == NULL )
+	continue;
+      undo_begin(ho->name);
+      undo_host(config, sn->network, ho->name);
+      host_set(config, ho, mac_ntoa(i, macbuf), ip_ntoa(0x0a000000U + i, ipbuf));
+      param_put(config, &ho->params, "option+host-name", ho->name);
+      undo_commit(config);
+    }
+    for ( r = 0; r < runs; r++ ) {
+      clock_gettime(CLOCK_MONOTONIC, &t);
+      for ( i = 0; undo_back(config); i++ );
+      while ( undo_forth(config) )
+	i--;
+      sec[r] = elapsed(&t);
+      if ( i != 0 || config->nhosts != nhosts )
+	rc = EXIT_FAILURE;
+    }
+    report("undo", sec, runs);
+    undo_reset();
+    destroy_conf(config);
+
+    /* addresses alone, random ones so digit counts vary */
+    macs = xmalloc(sizeof(*macs) * BENCH_ADDRS);
+    ips = xmalloc(sizeof(*ips) * BENCH_ADDRS);
+    for ( i = 0; i < BENCH_ADDRS; i++ ) {
+      seed ^= seed << 13;
+      seed ^= seed >> 7;
+      seed ^= seed << 17;
+      mac_ntoa(seed >> 16, macs[i]);
+      ip_ntoa(seed, ips[i]);
+    }
+    for ( r = 0; r < runs; r++ ) {
+      clock_gettime(CLOCK_MONOTONIC, &t);
+      for ( i = 0; i < BENCH_ADDRS; i++ ) {
+	bad += ! ip_aton(ips[i], &ip);
+	sum += ip;
+      }
+      sec[r] = elapsed(&t);
+    }
+    report("ip_aton", sec, runs);
+    for ( r = 0; r < runs; r++ ) {
+      clock_gettime(CLOCK_MONOTONIC, &t);
+      for ( i = 0; i < BENCH_ADDRS; i++ ) {
+	bad += ! mac_aton(macs[i], &mac);
+	sum += mac;
+      }
+      sec[r] = elapsed(&t);
+    }
+    report("mac_aton", sec, runs);
+    if ( bad != 0 || sum == 0 )
+      rc = EXIT_FAILURE;
+    for ( r = 0; r < runs; r++ ) {
+      clock_gettime(CLOCK_MONOTONIC, &t);
+      for ( i = 0; i < BENCH_ADDRS; i++ )
+	ip_ntoa(i * 2654435761U, ips[i]);
+      sec[r] = elapsed(&t);
+    }
+    report("ip_ntoa", sec, runs);
+    for ( r = 0; r < runs; r++ ) {
+      clock_gettime(CLOCK_MONOTONIC, &t);
+      for ( i = 0; i < BENCH_ADDRS; i++ )
+	mac_ntoa(i * 0x9E3779B97F4AULL, macs[i]);
+      sec[r] = elapsed(&t);
+    }
+    report("mac_ntoa", sec, runs);
+    free(macs);
+    free(ips);
+    free(sec);
+    if ( rc != EXIT_SUCCESS )
+      fprintf(stderr, "%s: a run failed\n", program_invocation_short_name);
+  }
+  nftw(dir, rmtree_entry, 16, FTW_DEPTH | FTW_PHYS);
+  free(filename);
+  crex_free();
+  file_cache_free();
+  arena_free(&undo.arena);
+  arena_free(&scratch);
+  exit (rc);
+}
@@ -22,13 +22,25 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <linux/fs.h>
 #include <unistd.h>
 #include <uregex.h>
-#include <aarray.h>
 #include <dialog.h>
 #include <errno.h>
 #include <stdarg.h>
 #include <dirent.h>
+#include <glob.h>
+#include <regex.h>
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
+#include <zlib.h>
+#include <getopt.h>
+#include <sys/inotify.h>
 
 #define VERSION     0
 #define SUBVERSION  1
@@ -39,338 +51,5525 @@
 #define DEFNAME     "dhcpd.conf"
 #define DEFCONFIG   DEFPATH DEFNAME
 
-/* Obtain configuration from file and put it into Asociative Array
- * Structure (AArray).
- */
-struct AArray *get_dhcpd_config (const char *filename) {
-  int fdes, ele_strarray, rid;
-  FILE *fstream;
-  char *gs = (char *) xmalloc (BUFSIZ);
-  char *prefix_subnet, *prefix_host;
-  char *prefix_plus_key;
-  struct AArray *config = new_aa();
-  char **strarray;
-  if ( ( fdes = open(filename, O_RDONLY) ) == -1 ) {
+/* Timers and counters, compiled in with -D_STATS only, otherwise the
+ * STAT_ macros are empty.  --stats file or DHCPDTUI_STATS=file writes
+ * them to that file after each action and on exit.  Counters are added
+ * atomically because the parse and save workers count too.
+ */
+enum stat_timer {
+  T_LOAD = 0,
+  T_MENU,
+  T_FILTER,
+  T_SAVE,
+  T_BACKUP,
+  T_WRITE,
+  T_CHECK,
+  T_COUNT
+};
+
+enum stat_counter {
+  C_REGCOMP = 0,
+  C_REGEXEC,
+  C_LITERAL,
+  C_MALLOC,
+  C_MALLOC_BYTES,
+  C_ARENA,
+  C_WRITTEN,
+  C_COUNT
+};
+
+#ifdef _STATS
+static struct {
+  double sec[T_COUNT];
+  long calls[T_COUNT];
+  unsigned long count[C_COUNT];
+  char *file;
+} stats;
+
+static void stat_time (enum stat_timer tm, double sec) {
+  stats.sec[tm] += sec;
+  stats.calls[tm]++;
+}
+
+static const char *stat_timer_name[T_COUNT] = {
+  "load", "menu", "filter", "save", "backup", "write", "check"
+};
+
+static const char *stat_counter_name[C_COUNT] = {
+  "regex_compile", "regex_exec", "literal_match", "malloc", "malloc_bytes",
+  "arena_alloc", "bytes_written"
+};
+
+/* Rewrite the stats file as key=value lines. */
+static void stat_dump (void) {
+  FILE *fp;
+  int i;
+  if ( stats.file == NULL || ( fp = fopen(stats.file, "w") ) == NULL )
+    return;
+  for ( i = 0; i < T_COUNT; i++ )
+    fprintf(fp, "timer=%s calls=%li total=%.6f\n", stat_timer_name[i], stats.calls[i], stats.sec[i]);
+  for ( i = 0; i < C_COUNT; i++ )
+    fprintf(fp, "counter=%s value=%lu\n", stat_counter_name[i],
+	    __atomic_load_n(&stats.count[i], __ATOMIC_RELAXED));
+  fclose(fp);
+}
+
+static void stat_stop (enum stat_timer tm, struct timespec *t0) {
+  struct timespec t1;
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  stat_time(tm, ( t1.tv_sec - t0->tv_sec ) + ( t1.tv_nsec - t0->tv_nsec ) / 1e9);
+}
+
+/* every heap allocation of this file is counted */
+static inline void *stat_xmalloc (size_t size) {
+  __atomic_fetch_add(&stats.count[C_MALLOC], 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&stats.count[C_MALLOC_BYTES], size, __ATOMIC_RELAXED);
+  return xmalloc(size);
+}
+
+static inline void *stat_xrealloc (void *ptr, size_t size) {
+  __atomic_fetch_add(&stats.count[C_MALLOC], 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&stats.count[C_MALLOC_BYTES], size, __ATOMIC_RELAXED);
+  return xrealloc(ptr, size);
+}
+
+# define xmalloc(size)             stat_xmalloc(size)
+# define xrealloc(ptr, size)       stat_xrealloc(ptr, size)
+# define STAT_ADD(counter, n)      __atomic_fetch_add(&stats.count[counter], (n), __ATOMIC_RELAXED)
+# define STAT_TIME(timer, sec)     stat_time(timer, sec)
+# define STAT_START(t0)            struct timespec t0; clock_gettime(CLOCK_MONOTONIC, &t0)
+# define STAT_STOP(timer, t0)      stat_stop(timer, &t0)
+#else
+# define STAT_ADD(counter, n)      do { } while ( 0 )
+# define STAT_TIME(timer, sec)     do { } while ( 0 )
+# define STAT_START(t0)
+# define STAT_STOP(timer, t0)      do { } while ( 0 )
+#endif
+
+/* Compiled pattern cache, every pattern given to m_crex, s_crex and
+ * as_crex is analyzed and compiled once.  Patterns which are just a
+ * literal, maybe anchored with '^' and/or '$', never reach the regex
+ * engine.
+ */
+enum crex_kind {
+  CREX_REGEX = 0,
+  CREX_SUBSTR,
+  CREX_PREFIX,
+  CREX_SUFFIX,
+  CREX_EXACT,
+  CREX_NONE
+};
+
+struct crex {
+  char *pattern;
+  char *flags;
+  enum crex_kind kind;
+  size_t len;
+  char *literal;
+  regex_t re;
+};
+
+static struct {
+  size_t size, used;
+  struct crex **slot;
+  long hits, misses;
+} crex_cache;
+
+static unsigned long crex_hash (const char *pattern, const char *flags) {
+  unsigned long h = 14695981039346656037UL;
+  while ( *pattern ) {
+    h ^= (unsigned char) *pattern++;
+    h *= 1099511628211UL;
+  }
+  while ( *flags ) {
+    h ^= (unsigned char) *flags++;
+    h *= 1099511628211UL;
+  }
+  return h;
+}
+
+/* Take a literal out of the pattern, returns 0 if it is a real regex. */
+static int crex_literal (struct crex *cx) {
+  const char *p = cx->pattern;
+  size_t plen = strlen(p);
+  int bol = 0, eol = 0;
+  cx->literal = xmalloc(plen + 1);
+  cx->len = 0;
+  if ( *p == '^' ) {
+    bol = 1;
+    p++;
+  }
+  for ( ; *p; p++ ) {
+    if ( *p == '\\' ) {
+      /* escaped punctuation is a literal char, escaped letters are classes */
+      if ( p[1] == 0x00 || ( p[1] >= '0' && p[1] <= '9' ) ||
+	   ( p[1] >= 'A' && p[1] <= 'Z' ) || ( p[1] >= 'a' && p[1] <= 'z' ) )
+	return 0;
+      cx->literal[cx->len++] = *++p;
+    } else if ( *p == '$' && p[1] == 0x00 ) {
+      eol = 1;
+    } else if ( strchr(".[]()*+?{}|^$", *p) != NULL ) {
+      return 0;
+    } else {
+      cx->literal[cx->len++] = *p;
+    }
+  }
+  cx->literal[cx->len] = 0x00; /* NULL */
+  if ( bol && eol )
+    cx->kind = CREX_EXACT;
+  else if ( bol )
+    cx->kind = CREX_PREFIX;
+  else if ( eol )
+    cx->kind = CREX_SUFFIX;
+  else if ( cx->len > 0 )
+    cx->kind = CREX_SUBSTR;
+  else
+    return 0;
+  return 1;
+}
+
+static struct crex *crex_get (const char *pattern, const char *flags) {
+  size_t i, j;
+  struct crex *cx, **slot;
+  /* just the case flag changes the compiled pattern */
+  flags = ( strchr(flags, 'i') != NULL ) ? "i" : "";
+  if ( crex_cache.size == 0 ) {
+    crex_cache.size = 64;
+    crex_cache.slot = xmalloc(sizeof(struct crex *) * crex_cache.size);
+    memset(crex_cache.slot, 0, sizeof(struct crex *) * crex_cache.size);
+  }
+  i = crex_hash(pattern, flags) & ( crex_cache.size - 1 );
+  while ( ( cx = crex_cache.slot[i] ) != NULL ) {
+    if ( strcmp(cx->pattern, pattern) == 0 && strcmp(cx->flags, flags) == 0 ) {
+      crex_cache.hits++;
+      return cx;
+    }
+    i = ( i + 1 ) & ( crex_cache.size - 1 );
+  }
+  crex_cache.misses++;
+  cx = xmalloc(sizeof(struct crex));
+  cx->pattern = savestring(pattern);
+  cx->flags = savestring(flags);
+  cx->kind = CREX_REGEX;
+  if ( *flags == 'i' || ! crex_literal(cx) ) {
+    cx->kind = CREX_REGEX;
+    STAT_ADD(C_REGCOMP, 1);
+    if ( regcomp(&cx->re, pattern, REG_EXTENDED | ( *flags == 'i' ? REG_ICASE : 0 )) != 0 ) {
+      /* a broken pattern never matches */
+      cx->kind = CREX_NONE;
+    }
+  }
+  crex_cache.slot[i] = cx;
+  /* keep the load factor under a half */
+  if ( ++crex_cache.used * 2 > crex_cache.size ) {
+    slot = crex_cache.slot;
+    crex_cache.size *= 2;
+    crex_cache.slot = xmalloc(sizeof(struct crex *) * crex_cache.size);
+    memset(crex_cache.slot, 0, sizeof(struct crex *) * crex_cache.size);
+    for ( j = 0; j < crex_cache.size / 2; j++ ) {
+      if ( slot[j] == NULL )
+	continue;
+      i = crex_hash(slot[j]->pattern, slot[j]->flags) & ( crex_cache.size - 1 );
+      while ( crex_cache.slot[i] != NULL )
+	i = ( i + 1 ) & ( crex_cache.size - 1 );
+      crex_cache.slot[i] = slot[j];
+    }
+    free(slot);
+  }
+  return cx;
+}
+
+/* Locate the next match from str, REG_NOTBOL when str is not the
+ * beginning of the subject.  Returns 0 when there is no match.
+ */
+static int crex_exec (struct crex *cx, const char *str, int notbol,
+		      size_t *so, size_t *eo) {
+  size_t slen;
+  const char *f;
+  regmatch_t rm;
+  if ( cx->kind == CREX_REGEX )
+    STAT_ADD(C_REGEXEC, 1);
+  else
+    STAT_ADD(C_LITERAL, 1);
+  switch (cx->kind) {
+  case CREX_NONE :
+    return 0;
+  case CREX_SUBSTR :
+    if ( ( f = memmem(str, strlen(str), cx->literal, cx->len) ) == NULL )
+      return 0;
+    *so = f - str;
+    break;
+  case CREX_PREFIX :
+    if ( notbol || strncmp(str, cx->literal, cx->len) != 0 )
+      return 0;
+    *so = 0;
+    break;
+  case CREX_SUFFIX :
+    slen = strlen(str);
+    if ( notbol && cx->len == 0 )
+      return 0;
+    if ( slen < cx->len || memcmp(str + slen - cx->len, cx->literal, cx->len) != 0 )
+      return 0;
+    *so = slen - cx->len;
+    break;
+  case CREX_EXACT :
+    if ( notbol || strlen(str) != cx->len || memcmp(str, cx->literal, cx->len) != 0 )
+      return 0;
+    *so = 0;
+    break;
+  default :
+    if ( regexec(&cx->re, str, 1, &rm, notbol ? REG_NOTBOL : 0) != 0 )
+      return 0;
+    *so = rm.rm_so;
+    *eo = rm.rm_eo;
+    return 1;
+  }
+  *eo = *so + cx->len;
+  return 1;
+}
+
+/* m_rex with cached pattern */
+int m_crex (const char *str, const char *pattern, const char *flags) {
+  size_t so, eo;
+  return crex_exec(crex_get(pattern, flags), str, 0, &so, &eo);
+}
+
+/* s_rex with cached pattern, returns a new string, "g" flag replaces
+ * every match.
+ */
+char *s_crex (const char *str, const char *pattern, const char *rep, const char *flags) {
+  struct crex *cx = crex_get(pattern, flags);
+  size_t so, eo, len = 0, rlen = strlen(rep), size = strlen(str) + rlen + 1;
+  int global = strchr(flags, 'g') != NULL;
+  const char *s = str;
+  char *out = xmalloc(size);
+  while ( crex_exec(cx, s, s != str, &so, &eo) ) {
+    if ( len + so + rlen + 1 > size ) {
+      size = ( len + so + rlen + 1 ) * 2;
+      out = xrealloc(out, size);
+    }
+    memcpy(out + len, s, so);
+    len += so;
+    memcpy(out + len, rep, rlen);
+    len += rlen;
+    if ( eo == so ) {
+      /* empty match, copy one char to move forward */
+      if ( s[eo] == 0x00 ) {
+	s += eo;
+	break;
+      }
+      out[len++] = s[eo++];
+    }
+    s += eo;
+    if ( ! global || cx->kind == CREX_SUFFIX || cx->kind == CREX_EXACT )
+      break;
+  }
+  so = strlen(s);
+  if ( len + so + 1 > size )
+    out = xrealloc(out, len + so + 1);
+  memcpy(out + len, s, so + 1);
+  return out;
+}
+
+/* as_rex with cached pattern, str is replaced by the result */
+char *as_crex (char *str, const char *pattern, const char *rep, const char *flags) {
+  char *out = s_crex(str, pattern, rep, flags);
+  free(str);
+  return out;
+}
+
+void crex_stats (long *hits, long *misses) {
+  *hits = crex_cache.hits;
+  *misses = crex_cache.misses;
+}
+
+void crex_free (void) {
+  size_t i;
+  for ( i = 0; i < crex_cache.size; i++ ) {
+    if ( crex_cache.slot[i] == NULL )
+      continue;
+    if ( crex_cache.slot[i]->kind == CREX_REGEX )
+      regfree(&crex_cache.slot[i]->re);
+    free(crex_cache.slot[i]->pattern);
+    free(crex_cache.slot[i]->flags);
+    free(crex_cache.slot[i]->literal);
+    free(crex_cache.slot[i]);
+  }
+  free(crex_cache.slot);
+  memset(&crex_cache, 0, sizeof(crex_cache));
+}
+
+/* Region allocator, memory is taken from big blocks and given back all
+ * at once.  Every loaded configuration owns one, menus and messages use
+ * the scratch one which is reset each time the main menu is shown.
+ */
+#define ARENA_BLOCK 65536
+
+struct arena_block {
+  struct arena_block *next;
+  size_t size, used;
+  char data[];
+};
+
+struct arena {
+  struct arena_block *head;
+  long blocks;
+  size_t bytes;
+  long total_allocs;   /* lifetime totals, resets do not clear them */
+  size_t peak_bytes;
+};
+
+static struct arena scratch;
+
+void *arena_alloc (struct arena *ar, size_t size) {
+  struct arena_block *bl = ar->head;
+  size_t bsz;
+  void *p;
+  size = ( size + 7 ) & ~(size_t) 7;
+  if ( bl == NULL || bl->used + size > bl->size ) {
+    /* big requests get a block of its own behind the current one */
+    bsz = ( size > ARENA_BLOCK / 4 ) ? size : ARENA_BLOCK;
+    bl = xmalloc(sizeof(struct arena_block) + bsz);
+    bl->size = bsz;
+    bl->used = 0;
+    if ( ar->head != NULL && bsz != ARENA_BLOCK ) {
+      bl->next = ar->head->next;
+      ar->head->next = bl;
+    } else {
+      bl->next = ar->head;
+      ar->head = bl;
+    }
+    ar->blocks++;
+    ar->bytes += sizeof(struct arena_block) + bsz;
+    if ( ar->bytes > ar->peak_bytes )
+      ar->peak_bytes = ar->bytes;
+  }
+  p = bl->data + bl->used;
+  bl->used += size;
+  ar->total_allocs++;
+  STAT_ADD(C_ARENA, 1);
+  return p;
+}
+
+char *arena_strndup (struct arena *ar, const char *s, size_t len) {
+  char *d = arena_alloc(ar, len + 1);
+  memcpy(d, s, len);
+  d[len] = 0x00; /* NULL */
+  return d;
+}
+
+char *arena_strdup (struct arena *ar, const char *s) {
+  return arena_strndup(ar, s, strlen(s));
+}
+
+char *arena_printf (struct arena *ar, const char *fmt, ...) {
+  va_list ap;
+  int len;
+  char *d;
+  va_start (ap, fmt);
+  len = vsnprintf(NULL, 0, fmt, ap);
+  va_end (ap);
+  d = arena_alloc(ar, len + 1);
+  va_start (ap, fmt);
+  vsnprintf(d, len + 1, fmt, ap);
+  va_end (ap);
+  return d;
+}
+
+/* Give back every block but the last one taken, it is reused. */
+void arena_reset (struct arena *ar) {
+  struct arena_block *bl, *next;
+  if ( ar->head == NULL )
+    return;
+  for ( bl = ar->head->next; bl != NULL; bl = next ) {
+    next = bl->next;
+    ar->bytes -= sizeof(struct arena_block) + bl->size;
+    ar->blocks--;
+    free(bl);
+  }
+  ar->head->next = NULL;
+  ar->head->used = 0;
+}
+
+/* Move every block of from behind the current one of ar, so they are
+ * freed with ar, from is left empty.
+ */
+void arena_adopt (struct arena *ar, struct arena *from) {
+  struct arena_block *bl;
+  if ( from->head == NULL )
+    return;
+  if ( ar->head == NULL ) {
+    ar->head = from->head;
+  } else {
+    for ( bl = from->head; bl->next != NULL; bl = bl->next )
+      ;
+    bl->next = ar->head->next;
+    ar->head->next = from->head;
+  }
+  ar->total_allocs += from->total_allocs;
+  ar->blocks += from->blocks;
+  ar->bytes += from->bytes;
+  if ( ar->bytes > ar->peak_bytes )
+    ar->peak_bytes = ar->bytes;
+  memset(from, 0, sizeof(struct arena));
+}
+
+void arena_free (struct arena *ar) {
+  struct arena_block *bl, *next;
+  for ( bl = ar->head; bl != NULL; bl = next ) {
+    next = bl->next;
+    free(bl);
+  }
+  ar->head = NULL;
+  ar->bytes = 0;
+  ar->blocks = 0;
+}
+
+/* Configuration model: global statements, then subnets with its hosts
+ * and statements (ranges, options...).  Lists keep the file order, the
+ * shared-network is one more global statement as before.  Everything is
+ * allocated in the arena of the configuration, replaced or deleted
+ * values stay there until the configuration is destroyed.
+ */
+struct conf_file;
+
+struct dhcpd_param {
+  char *name;   /* "option+routers", "range0", "default-lease-time"... */
+  char *value;
+  struct conf_file *file;   /* where a global statement is written */
+  struct dhcpd_param *next;
+};
+
+struct dhcpd_params {
+  int rid;      /* next range id */
+  long count;
+  struct dhcpd_param *first, *last;
+};
+
+struct dhcpd_subnet;
+
+struct dhcpd_host {
+  char *name;
+  char *hardware;   /* hardware ethernet */
+  char *address;    /* fixed-address */
+  uint64_t mac;     /* binary hardware, valid when has_mac */
+  uint32_t ip;      /* binary address, valid when has_ip */
+  uint64_t namehash;
+  long seq;         /* order of creation, unique in the configuration */
+  int has_mac, has_ip;
+  struct dhcpd_params params;
+  struct conf_file *file;
+  struct dhcpd_subnet *subnet;
+  struct dhcpd_host *next;
+  struct dhcpd_host *mac_next, *ip_next, *name_next;   /* index chains */
+};
+
+struct dhcpd_subnet {
+  char *network;
+  char *netmask;
+  uint32_t net;
+  int has_net;
+  long nhosts;
+  struct dhcpd_host *hosts, *hosts_last;
+  struct dhcpd_params params;
+  struct conf_file *file;
+  struct dhcpd_subnet *next;
+};
+
+/* Hash index of hosts by binary MAC, IP or by name, chained through
+ * the hosts so several hosts may share a key.
+ */
+enum host_key {
+  KEY_MAC = 0,
+  KEY_IP,
+  KEY_NAME
+};
+
+struct host_index {
+  size_t size, count;
+  struct dhcpd_host **bucket;
+};
+
+/* Subnets sorted by network address, networks that are not an IPv4
+ * address go last by name.  Kept up to date by subnet_put.
+ */
+struct subnet_view {
+  long count, size;
+  struct dhcpd_subnet **subnet;
+};
+
+/* An include statement, scope is the subnet it is written in. */
+struct conf_include {
+  char *name;
+  struct dhcpd_subnet *scope;
+  struct conf_file *parent;
+  struct conf_include *next;
+};
+
+/* Subnets and ranges as uint32 intervals, used by the checks. */
+struct interval {
+  uint32_t lo, hi;
+  uint32_t maxhi;              /* highest hi from the first one to this */
+  long maxat;                  /* the interval with that hi */
+  struct dhcpd_subnet *sn;
+  struct dhcpd_param *pa;      /* the range, NULL for the subnet itself */
+};
+
+struct interval_index {
+  long count, size;
+  struct interval *iv;
+};
+
+/* Statements, subnets and hosts know the file they come from, NULL is
+ * dhcpd.conf itself.  New ones go to the file being loaded, or hosts
+ * to the file of its subnet.
+ */
+struct dhcpd_conf {
+  struct arena arena;
+  long nsubnets, nhosts;
+  struct dhcpd_params globals;
+  struct dhcpd_subnet *subnets, *subnets_last;
+  struct subnet_view sorted;
+  struct host_index by_mac, by_ip, by_name;
+  long host_seq;             /* last seq given to a host */
+  struct interval_index nets, ranges;
+  int checks_valid;          /* nets and ranges are up to date */
+  struct conf_file *file;    /* being loaded */
+  struct conf_file **files;  /* dhcpd.conf, then included files */
+  int nfiles;
+  int *file_map, file_mapsz; /* slot of each file, hashed by entry */
+  struct conf_include *includes, *includes_last;
+  void *map;                 /* model cache the strings point into */
+  size_t maplen;
+};
+
+/* Hex digit value plus one of every char, 0 for anything else. */
+static const unsigned char hex_digit[256] = {
+  ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+  ['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+  ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+  ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16
+};
+
+/* Parse "xx:xx:xx:xx:xx:xx" (one or two hex digits each) to 48 bits.
+ * The usual two digit form is read straight off the table with the
+ * checks or-ed together, one branch for the whole address.
+ */
+int mac_aton (const char *s, uint64_t *mac) {
+  const unsigned char *u = (const unsigned char *) s;
+  unsigned hi, lo, bad = 0;
+  int i, n, d;
+  uint64_t m = 0;
+  if ( strnlen(s, 18) == 17 ) {
+    for ( i = 0; i < 18; i += 3 ) {
+      hi = hex_digit[u[i]] - 1;
+      lo = hex_digit[u[i + 1]] - 1;
+      bad |= hi | lo;
+      m = ( m << 8 ) | ( hi << 4 ) | lo;
+    }
+    bad |= ( ( u[2] ^ ':' ) | ( u[5] ^ ':' ) | ( u[8] ^ ':' ) | ( u[11] ^ ':' ) | ( u[14] ^ ':' ) ) << 4;
+    if ( bad > 15 )
+      return 0;
+    *mac = m;
+    return 1;
+  }
+  for ( i = 0; i < 6; i++ ) {
+    for ( n = 0, d = 0; n < 3 && hex_digit[*u]; n++, u++ )
+      d = d * 16 + hex_digit[*u] - 1;
+    if ( n == 0 || n > 2 || *u != ( ( i < 5 ) ? ':' : 0x00 ) )
+      return 0;
+    m = ( m << 8 ) | d;
+    u++;
+  }
+  *mac = m;
+  return 1;
+}
+
+/* Parse a dotted quad IPv4 address to 32 bits, one to three digits
+ * each.  Digit counts and the overflow check are worked out with
+ * selects instead of a loop per digit.
+ */
+int ip_aton (const char *s, uint32_t *ip) {
+  const unsigned char *u = (const unsigned char *) s;
+  unsigned d0, d1, d2, two, three, bad = 0;
+  uint32_t a = 0;
+  int i;
+  for ( i = 0; i < 4; i++ ) {
+    d0 = u[0] - '0';
+    if ( d0 > 9 )
+      return 0;
+    d1 = u[1] - '0';
+    two = ( d1 <= 9 );
+    d2 = two ? u[2] - '0' : 10;
+    three = ( d2 <= 9 );
+    d1 = two ? d1 : 0;
+    d2 = three ? d2 : 0;
+    /* 1, 2 or 3 digits: d0, d0 d1 or d0 d1 d2 */
+    d0 = three ? d0 * 100 + d1 * 10 + d2 : two ? d0 * 10 + d1 : d0;
+    bad |= ( d0 > 255 );
+    u += 1 + two + three;
+    if ( *u != ( ( i < 3 ) ? '.' : 0x00 ) )
+      return 0;
+    a = ( a << 8 ) | d0;
+    u++;
+  }
+  if ( bad )
+    return 0;
+  *ip = a;
+  return 1;
+}
+
+/* Canonical text of an address, lowercase two digit MAC octets and a
+ * dotted quad without leading zeros.  buf holds 18 and 16 chars.
+ */
+char *mac_ntoa (uint64_t mac, char *buf) {
+  static const char hex[] = "0123456789abcdef";
+  int i;
+  for ( i = 0; i < 6; i++ ) {
+    buf[i * 3] = hex[( mac >> ( 44 - i * 8 ) ) & 0xf];
+    buf[i * 3 + 1] = hex[( mac >> ( 40 - i * 8 ) ) & 0xf];
+    buf[i * 3 + 2] = ':';
+  }
+  buf[17] = 0x00; /* NULL */
+  return buf;
+}
+
+char *ip_ntoa (uint32_t ip, char *buf) {
+  char *p = buf;
+  unsigned o;
+  int i;
+  for ( i = 24; i >= 0; i -= 8 ) {
+    o = ( ip >> i ) & 0xff;
+    *p = '0' + o / 100;
+    p += ( o >= 100 );
+    *p = '0' + o / 10 % 10;
+    p += ( o >= 10 );
+    *p++ = '0' + o % 10;
+    *p++ = '.';
+  }
+  p[-1] = 0x00; /* NULL */
+  return buf;
+}
+
+static uint64_t name_hash (const char *name) {
+  uint64_t h = 14695981039346656037ULL;
+  while ( *name ) {
+    h ^= (unsigned char) *name++;
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+static inline uint64_t host_keyval (struct dhcpd_host *ho, enum host_key k) {
+  return ( k == KEY_MAC ) ? ho->mac : ( k == KEY_IP ) ? ho->ip : ho->namehash;
+}
+
+static inline struct dhcpd_host **host_link (struct dhcpd_host *ho, enum host_key k) {
+  return ( k == KEY_MAC ) ? &ho->mac_next : ( k == KEY_IP ) ? &ho->ip_next : &ho->name_next;
+}
+
+static inline size_t index_slot (struct host_index *ix, uint64_t key) {
+  return ( key * 0x9E3779B97F4A7C15ULL ) >> 32 & ( ix->size - 1 );
+}
+
+static void index_add (struct host_index *ix, struct dhcpd_host *ho, enum host_key k) {
+  size_t i, size;
+  struct dhcpd_host **bucket, *next;
+  if ( ix->count >= ix->size ) {
+    /* grow to keep chains short, rehash every host */
+    bucket = ix->bucket;
+    size = ix->size;
+    ix->size = ( size > 0 ) ? size * 2 : 1024;
+    ix->bucket = xmalloc(sizeof(struct dhcpd_host *) * ix->size);
+    memset(ix->bucket, 0, sizeof(struct dhcpd_host *) * ix->size);
+    for ( i = 0; i < size; i++ ) {
+      for ( ; bucket[i] != NULL; bucket[i] = next ) {
+	next = *host_link(bucket[i], k);
+	*host_link(bucket[i], k) = ix->bucket[index_slot(ix, host_keyval(bucket[i], k))];
+	ix->bucket[index_slot(ix, host_keyval(bucket[i], k))] = bucket[i];
+      }
+    }
+    free(bucket);
+  }
+  i = index_slot(ix, host_keyval(ho, k));
+  *host_link(ho, k) = ix->bucket[i];
+  ix->bucket[i] = ho;
+  ix->count++;
+}
+
+/* Room for n keys at once, before the first one is added. */
+static void index_reserve (struct host_index *ix, size_t n) {
+  if ( ix->size > 0 )
+    return;
+  for ( ix->size = 1024; ix->size <= n; ix->size *= 2 )
+    ;
+  ix->bucket = xmalloc(sizeof(struct dhcpd_host *) * ix->size);
+  memset(ix->bucket, 0, sizeof(struct dhcpd_host *) * ix->size);
+}
+
+static void index_del (struct host_index *ix, struct dhcpd_host *ho, enum host_key k) {
+  struct dhcpd_host **link;
+  if ( ix->size == 0 )
+    return;
+  for ( link = &ix->bucket[index_slot(ix, host_keyval(ho, k))]; *link != NULL; link = host_link(*link, k) ) {
+    if ( *link == ho ) {
+      *link = *host_link(ho, k);
+      *host_link(ho, k) = NULL;
+      ix->count--;
+      return;
+    }
+  }
+}
+
+/* First host with key which is not except, NULL if none. */
+static struct dhcpd_host *index_find (struct host_index *ix, uint64_t key, enum host_key k,
+				      struct dhcpd_host *except) {
+  struct dhcpd_host *ho;
+  if ( ix->size == 0 )
+    return NULL;
+  for ( ho = ix->bucket[index_slot(ix, key)]; ho != NULL; ho = *host_link(ho, k) )
+    if ( host_keyval(ho, k) == key && ho != except )
+      return ho;
+  return NULL;
+}
+
+/* Next host with key after ho, the first one when ho is NULL. */
+static struct dhcpd_host *index_next (struct host_index *ix, struct dhcpd_host *ho, uint64_t key,
+				      enum host_key k) {
+  if ( ix->size == 0 )
+    return NULL;
+  for ( ho = ( ho != NULL ) ? *host_link(ho, k) : ix->bucket[index_slot(ix, key)]; ho != NULL;
+	ho = *host_link(ho, k) )
+    if ( host_keyval(ho, k) == key )
+      return ho;
+  return NULL;
+}
+
+struct dhcpd_host *host_find_mac (struct dhcpd_conf *config, const char *hardware,
+				  struct dhcpd_host *except) {
+  uint64_t mac;
+  if ( hardware == NULL || ! mac_aton(hardware, &mac) )
+    return NULL;
+  return index_find(&config->by_mac, mac, KEY_MAC, except);
+}
+
+struct dhcpd_host *host_find_ip (struct dhcpd_conf *config, const char *address,
+				 struct dhcpd_host *except) {
+  uint32_t ip;
+  if ( address == NULL || ! ip_aton(address, &ip) )
+    return NULL;
+  return index_find(&config->by_ip, ip, KEY_IP, except);
+}
+
+static inline char *conf_string (struct dhcpd_conf *config, const char *src) {
+  return ( src != NULL ) ? arena_strdup(&config->arena, src) : NULL;
+}
+
+struct dhcpd_param *param_get (struct dhcpd_params *pl, const char *name) {
+  struct dhcpd_param *pa;
+  for ( pa = pl->first; pa != NULL; pa = pa->next )
+    if ( strcmp(pa->name, name) == 0 )
+      return pa;
+  return NULL;
+}
+
+/* Change the value of name or append it at the end of the list. */
+struct dhcpd_param *param_put (struct dhcpd_conf *config, struct dhcpd_params *pl,
+			       const char *name, const char *value) {
+  struct dhcpd_param *pa;
+  if ( ( pa = param_get(pl, name) ) != NULL ) {
+    pa->value = conf_string(config, value);
+    return pa;
+  }
+  pa = arena_alloc(&config->arena, sizeof(struct dhcpd_param));
+  pa->name = conf_string(config, name);
+  pa->value = conf_string(config, value);
+  pa->file = config->file;
+  pa->next = NULL;
+  if ( pl->last != NULL )
+    pl->last->next = pa;
+  else
+    pl->first = pa;
+  pl->last = pa;
+  pl->count++;
+  return pa;
+}
+
+/* Ranges are numbered in the order they are added: range0, range1... */
+struct dhcpd_param *param_put_range (struct dhcpd_conf *config, struct dhcpd_params *pl,
+				     const char *value) {
+  char name[32];
+  snprintf(name, sizeof(name), "range%i", pl->rid++);
+  return param_put(config, pl, name, value);
+}
+
+static int param_is_range (struct dhcpd_param *pa) {
+  return strncmp(pa->name, "range", 5) == 0 && pa->name[5] >= '0' && pa->name[5] <= '9';
+}
+
+static int param_is_option (struct dhcpd_param *pa) {
+  return strncmp(pa->name, "option+", 7) == 0;
+}
+
+static int subnet_cmp (int has_net, uint32_t net, const char *network, const struct dhcpd_subnet *sn) {
+  if ( has_net != sn->has_net )
+    return has_net ? -1 : 1;
+  if ( has_net && net != sn->net )
+    return ( net < sn->net ) ? -1 : 1;
+  return strcmp(network, sn->network);
+}
+
+static int subnet_ptr_cmp (const void *a, const void *b) {
+  const struct dhcpd_subnet *sa = *(struct dhcpd_subnet * const *) a;
+  return subnet_cmp(sa->has_net, sa->net, sa->network, *(struct dhcpd_subnet * const *) b);
+}
+
+/* First position of the view not below the given key. */
+static long subnet_lower (struct subnet_view *sv, int has_net, uint32_t net, const char *network) {
+  long lo = 0, hi = sv->count, mid;
+  while ( lo < hi ) {
+    mid = lo + ( hi - lo ) / 2;
+    if ( subnet_cmp(has_net, net, network, sv->subnet[mid]) > 0 )
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+struct dhcpd_subnet *subnet_get (struct dhcpd_conf *config, const char *network) {
+  struct subnet_view *sv = &config->sorted;
+  uint32_t net = 0;
+  int has_net = ip_aton(network, &net);
+  long i = subnet_lower(sv, has_net, net, network);
+  if ( i < sv->count && subnet_cmp(has_net, net, network, sv->subnet[i]) == 0 )
+    return sv->subnet[i];
+  return NULL;
+}
+
+/* Subnets whose network falls inside prefix/bits, in address order.
+ * Returns the first one of the view and its count in *count, bits 0
+ * gives every subnet with an IPv4 network.
+ */
+struct dhcpd_subnet **subnet_span (struct dhcpd_conf *config, uint32_t prefix, int bits, long *count) {
+  struct subnet_view *sv = &config->sorted;
+  uint32_t mask = ( bits > 0 ) ? 0xffffffffU << ( 32 - bits ) : 0;
+  uint32_t first = prefix & mask, last = first | ~mask;
+  long lo, hi;
+  lo = subnet_lower(sv, 1, first, "");
+  hi = ( last == 0xffffffffU ) ? subnet_lower(sv, 0, 0, "") : subnet_lower(sv, 1, last + 1, "");
+  *count = hi - lo;
+  return sv->subnet + lo;
+}
+
+/* Append sn to the list and put it at position i of the view. */
+static void subnet_link (struct dhcpd_conf *config, struct dhcpd_subnet *sn, long i) {
+  struct subnet_view *sv = &config->sorted;
+  sn->next = NULL;
+  if ( config->subnets_last != NULL )
+    config->subnets_last->next = sn;
+  else
+    config->subnets = sn;
+  config->subnets_last = sn;
+  config->nsubnets++;
+  if ( sv->count == sv->size ) {
+    sv->size = ( sv->size > 0 ) ? 2 * sv->size : 64;
+    sv->subnet = xrealloc(sv->subnet, sizeof(struct dhcpd_subnet *) * sv->size);
+  }
+  memmove(sv->subnet + i + 1, sv->subnet + i, sizeof(struct dhcpd_subnet *) * ( sv->count - i ));
+  sv->subnet[i] = sn;
+  sv->count++;
+}
+
+/* Change the netmask of network or append a new subnet. */
+struct dhcpd_subnet *subnet_put (struct dhcpd_conf *config, const char *network, const char *netmask) {
+  struct subnet_view *sv = &config->sorted;
+  struct dhcpd_subnet *sn;
+  uint32_t net = 0;
+  int has_net = ip_aton(network, &net);
+  long i = subnet_lower(sv, has_net, net, network);
+  config->checks_valid = 0;
+  if ( i < sv->count && subnet_cmp(has_net, net, network, sv->subnet[i]) == 0 ) {
+    sn = sv->subnet[i];
+    sn->netmask = conf_string(config, netmask);
+    return sn;
+  }
+  sn = arena_alloc(&config->arena, sizeof(struct dhcpd_subnet));
+  memset(sn, 0, sizeof(struct dhcpd_subnet));
+  sn->network = conf_string(config, network);
+  sn->netmask = conf_string(config, netmask);
+  sn->net = net;
+  sn->has_net = has_net;
+  sn->file = config->file;
+  subnet_link(config, sn, i);
+  return sn;
+}
+
+struct dhcpd_host *host_get (struct dhcpd_conf *config, struct dhcpd_subnet *sn, const char *name) {
+  struct dhcpd_host *ho;
+  uint64_t h = name_hash(name);
+  if ( config->by_name.size == 0 )
+    return NULL;
+  for ( ho = config->by_name.bucket[index_slot(&config->by_name, h)]; ho != NULL; ho = ho->name_next )
+    if ( ho->namehash == h && ho->subnet == sn && strcmp(ho->name, name) == 0 )
+      return ho;
+  return NULL;
+}
+
+/* Change hardware and/or address of a host keeping the indexes, NULL
+ * values are left untouched.
+ */
+void host_set (struct dhcpd_conf *config, struct dhcpd_host *ho,
+	       const char *hardware, const char *address) {
+  if ( hardware != NULL ) {
+    if ( ho->has_mac )
+      index_del(&config->by_mac, ho, KEY_MAC);
+    ho->hardware = conf_string(config, hardware);
+    if ( ( ho->has_mac = mac_aton(hardware, &ho->mac) ) )
+      index_add(&config->by_mac, ho, KEY_MAC);
+  }
+  if ( address != NULL ) {
+    if ( ho->has_ip )
+      index_del(&config->by_ip, ho, KEY_IP);
+    ho->address = conf_string(config, address);
+    if ( ( ho->has_ip = ip_aton(address, &ho->ip) ) )
+      index_add(&config->by_ip, ho, KEY_IP);
+  }
+}
+
+/* Change the host or append it to the subnet. */
+struct dhcpd_host *host_put (struct dhcpd_conf *config, struct dhcpd_subnet *sn, const char *name,
+			     const char *hardware, const char *address) {
+  struct dhcpd_host *ho;
+  if ( ( ho = host_get(config, sn, name) ) == NULL ) {
+    ho = arena_alloc(&config->arena, sizeof(struct dhcpd_host));
+    memset(ho, 0, sizeof(struct dhcpd_host));
+    ho->name = conf_string(config, name);
+    ho->namehash = name_hash(name);
+    ho->seq = ++config->host_seq;
+    ho->subnet = sn;
+    ho->file = ( config->file != NULL ) ? config->file : sn->file;
+    if ( sn->hosts_last != NULL )
+      sn->hosts_last->next = ho;
+    else
+      sn->hosts = ho;
+    sn->hosts_last = ho;
+    sn->nhosts++;
+    config->nhosts++;
+    index_add(&config->by_name, ho, KEY_NAME);
+  }
+  host_set(config, ho, hardware, address);
+  return ho;
+}
+
+int host_delete (struct dhcpd_conf *config, struct dhcpd_subnet *sn, const char *name) {
+  struct dhcpd_host *ho, *prev = NULL;
+  for ( ho = sn->hosts; ho != NULL; prev = ho, ho = ho->next ) {
+    if ( strcmp(ho->name, name) == 0 ) {
+      if ( prev != NULL )
+	prev->next = ho->next;
+      else
+	sn->hosts = ho->next;
+      if ( sn->hosts_last == ho )
+	sn->hosts_last = prev;
+      sn->nhosts--;
+      config->nhosts--;
+      if ( ho->has_mac )
+	index_del(&config->by_mac, ho, KEY_MAC);
+      if ( ho->has_ip )
+	index_del(&config->by_ip, ho, KEY_IP);
+      index_del(&config->by_name, ho, KEY_NAME);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* Remove a subnet with its hosts, 0 when an include is scoped to it. */
+int subnet_delete (struct dhcpd_conf *config, struct dhcpd_subnet *sn) {
+  struct subnet_view *sv = &config->sorted;
+  struct dhcpd_subnet *prev = NULL, *s;
+  struct conf_include *inc;
+  long i;
+  for ( inc = config->includes; inc != NULL; inc = inc->next )
+    if ( inc->scope == sn )
+      return 0;
+  while ( sn->hosts != NULL )
+    host_delete(config, sn, sn->hosts->name);
+  for ( s = config->subnets; s != NULL && s != sn; prev = s, s = s->next );
+  if ( s == NULL )
+    return 0;
+  if ( prev != NULL )
+    prev->next = sn->next;
+  else
+    config->subnets = sn->next;
+  if ( config->subnets_last == sn )
+    config->subnets_last = prev;
+  config->nsubnets--;
+  i = subnet_lower(sv, sn->has_net, sn->net, sn->network);
+  memmove(sv->subnet + i, sv->subnet + i + 1, sizeof(struct dhcpd_subnet *) * ( sv->count - i - 1 ));
+  sv->count--;
+  config->checks_valid = 0;
+  return 1;
+}
+
+struct dhcpd_conf *new_conf (void) {
+  struct arena ar;
+  struct dhcpd_conf *config;
+  memset(&ar, 0, sizeof(struct arena));
+  config = arena_alloc(&ar, sizeof(struct dhcpd_conf));
+  memset(config, 0, sizeof(struct dhcpd_conf));
+  config->arena = ar;
+  return config;
+}
+
+/* The configuration lives in its own arena, only the view and index
+ * tables are kept apart because they are reallocated while growing.
+ */
+void destroy_conf (struct dhcpd_conf *config) {
+  struct arena ar = config->arena;
+  free(config->sorted.subnet);
+  free(config->by_mac.bucket);
+  free(config->by_ip.bucket);
+  free(config->by_name.bucket);
+  free(config->nets.iv);
+  free(config->ranges.iv);
+  free(config->files);
+  free(config->file_map);
+  if ( config->map != NULL )
+    munmap(config->map, config->maplen);
+  arena_free(&ar);
+}
+
+/* Tokens produced by the dhcpd.conf lexer. */
+enum dhcpd_token {
+  TOK_EOF = 0,
+  TOK_KEYWORD,
+  TOK_IDENTIFIER,
+  TOK_ADDRESS,
+  TOK_STRING,
+  TOK_SEMICOLON,
+  TOK_LBRACE,
+  TOK_RBRACE
+};
+
+/* Single pass lexer over the whole file in memory.  Tokens are views
+ * of that buffer, terminated in place by writing 0x00 over the char
+ * which ends them, so nothing is copied or allocated.
+ */
+struct dhcpd_lexer {
+  char *p, *end;
+  int pending;
+  char *tok;
+  size_t toklen;
+};
+
+/* Words of one statement, from its first token up to ';', '{' or '}'. */
+struct dhcpd_statement {
+  int words, size;
+  char **word;
+};
+
+static const char *dhcpd_keywords[] = {
+  "authoritative", "ddns-update-style", "default-lease-time", "ethernet",
+  "fixed-address", "hardware", "host", "log-facility", "max-lease-time",
+  "include", "netmask", "option", "range", "shared-network", "subnet", NULL
+};
+
+/* Read the whole file in one buffer, one more byte is left after the
+ * end for the last token terminator.  The file is read instead of
+ * mapped because tokens are terminated in place, and because a mapped
+ * file truncated by another editor would raise SIGBUS.
+ */
+static char *load_file (const char *filename, size_t *size) {
+  int fdes;
+  ssize_t rd;
+  size_t len = 0, bufsz;
+  struct stat sb;
+  char *buf;
+  if ( ( fdes = open(filename, O_RDONLY) ) == -1 )
+    return NULL;
+  bufsz = ( fstat(fdes, &sb) == 0 && sb.st_size > 0 ) ? sb.st_size + 1 : BUFSIZ;
+  buf = xmalloc(bufsz);
+  for ( ;; ) {
+    if ( len + 1 == bufsz ) {
+      /* the file grew or it is not a regular one */
+      bufsz *= 2;
+      buf = xrealloc(buf, bufsz);
+    }
+    if ( ( rd = read(fdes, buf + len, bufsz - len - 1) ) == -1 ) {
+      if ( errno == EINTR )
+	continue;
+      free(buf);
+      close(fdes);
+      return NULL;
+    }
+    if ( rd == 0 )
+      break;
+    len += rd;
+  }
+  close(fdes);
+  buf[len] = 0x00; /* NULL */
+  *size = len;
+  return buf;
+}
+
+static inline int lex_getc (struct dhcpd_lexer *lx) {
+  int c;
+  if ( lx->pending != EOF ) {
+    c = lx->pending;
+    lx->pending = EOF;
+    return c;
+  }
+  return ( lx->p < lx->end ) ? (unsigned char) *lx->p++ : EOF;
+}
+
+static inline int lex_isspace (int c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+}
+
+static inline int lex_isdelim (int c) {
+  return c == EOF || c == ';' || c == '{' || c == '}' || c == '#' || lex_isspace(c);
+}
+
+/* Address tokens: dotted IPv4 or colon separated MAC. */
+static int lex_isaddress (const char *s, size_t len) {
+  size_t i;
+  int dots = 0, colons = 0, digits = 1;
+  for ( i = 0; i < len; i++ ) {
+    if ( s[i] == '.' )
+      dots++;
+    else if ( s[i] == ':' )
+      colons++;
+    else if ( s[i] >= '0' && s[i] <= '9' )
+      continue;
+    else if ( ( s[i] >= 'a' && s[i] <= 'f' ) || ( s[i] >= 'A' && s[i] <= 'F' ) )
+      digits = 0;
+    else
+      return 0;
+  }
+  return ( dots == 3 && colons == 0 && digits ) || ( colons == 5 && dots == 0 );
+}
+
+static enum dhcpd_token lex_next (struct dhcpd_lexer *lx) {
+  int c, quoted = 0;
+  const char **kw;
+  for ( ;; ) {
+    c = lex_getc(lx);
+    if ( c == EOF )
+      return TOK_EOF;
+    if ( lex_isspace(c) )
+      continue;
+    if ( c == '#' ) {
+      while ( ( c = lex_getc(lx) ) != EOF && c != '\n' )
+	;
+      continue;
+    }
+    break;
+  }
+  switch (c) {
+  case ';' : return TOK_SEMICOLON;
+  case '{' : return TOK_LBRACE;
+  case '}' : return TOK_RBRACE;
+  }
+  /* a word runs until a delimiter outside quotes, so quoted strings
+   * keep their '#', ';' and braces */
+  lx->tok = lx->p - 1;
+  while ( quoted || ! lex_isdelim(c) ) {
+    if ( c == EOF )
+      break;
+    if ( c == '"' ) {
+      quoted = ! quoted;
+    } else if ( quoted && c == '\\' ) {
+      if ( lex_getc(lx) == EOF )
+	break;
+    }
+    c = lex_getc(lx);
+  }
+  if ( c == EOF ) {
+    lx->toklen = lx->end - lx->tok;
+  } else {
+    lx->toklen = lx->p - 1 - lx->tok;
+    if ( ! lex_isspace(c) )
+      lx->pending = c;
+  }
+  lx->tok[lx->toklen] = 0x00; /* NULL */
+  if ( lx->tok[0] == '"' )
+    return TOK_STRING;
+  for ( kw = dhcpd_keywords; *kw != NULL; kw++ )
+    if ( strcmp(lx->tok, *kw) == 0 )
+      return TOK_KEYWORD;
+  if ( lex_isaddress(lx->tok, lx->toklen) )
+    return TOK_ADDRESS;
+  return TOK_IDENTIFIER;
+}
+
+static void stmt_push (struct dhcpd_statement *st, char *word) {
+  if ( st->words == st->size ) {
+    st->size = ( st->size > 0 ) ? st->size * 2 : 16;
+    st->word = xrealloc(st->word, sizeof(char *) * st->size);
+  }
+  st->word[st->words++] = word;
+}
+
+static inline const char *stmt_word (struct dhcpd_statement *st, int w) {
+  return st->word[w];
+}
+
+/* Join words from..to-1 with sep moving them over the blanks between
+ * them in the file buffer, the result is left in word[from].
+ */
+static char *stmt_join (struct dhcpd_statement *st, int from, int to, char sep) {
+  char *dst = st->word[from] + strlen(st->word[from]);
+  size_t len;
+  int w;
+  for ( w = from + 1; w < to; w++ ) {
+    len = strlen(st->word[w]);
+    *dst++ = sep;
+    memmove(dst, st->word[w], len);
+    dst += len;
+  }
+  *dst = 0x00; /* NULL */
+  return st->word[from];
+}
+
+/* Scopes opened by '{', closing a host or subnet leaves it. */
+enum dhcpd_scope {
+  SCOPE_OTHER = 0,
+  SCOPE_SUBNET,
+  SCOPE_HOST
+};
+
+#define DHCPD_MAXDEPTH 32
+
+struct dhcpd_parser {
+  int depth;
+  enum dhcpd_scope scope[DHCPD_MAXDEPTH];
+  struct dhcpd_subnet *subnet;
+  struct dhcpd_host *host;
+};
+
+/* Reserved keywords, other statements are not loaded. */
+static int is_reserved (const char *word) {
+  static const char *reserved[] = {
+    "ddns-update-style", "default-lease-time", "max-lease-time", "shared-network",
+    "authoritative", "log-facility", "subnet", "host", "hardware", "fixed-address",
+    "option", "range", "include", NULL
+  };
+  const char **rw;
+  for ( rw = reserved; *rw != NULL; rw++ )
+    if ( strcmp(word, *rw) == 0 )
+      return 1;
+  return 0;
+}
+
+/* Keep an include statement of the file being loaded, the files it
+ * names are loaded after it.
+ */
+static void include_add (struct dhcpd_conf *config, const char *name, struct dhcpd_subnet *scope) {
+  struct conf_include *inc = arena_alloc(&config->arena, sizeof(struct conf_include));
+  inc->name = conf_string(config, name);
+  inc->scope = scope;
+  inc->parent = config->file;
+  inc->next = NULL;
+  if ( config->includes_last != NULL )
+    config->includes_last->next = inc;
+  else
+    config->includes = inc;
+  config->includes_last = inc;
+}
+
+/* Put one statement into the model, returns the scope it opens when it
+ * is followed by '{'.
+ */
+static enum dhcpd_scope parse_statement (struct dhcpd_conf *config, struct dhcpd_parser *ps,
+					 struct dhcpd_statement *st) {
+  const char *key, *value;
+  int vstart = 1, is_option;
+  struct dhcpd_params *pl;
+  if ( st->words == 0 || ! is_reserved(stmt_word(st, 0)) )
+    return SCOPE_OTHER;
+  if ( strcmp(stmt_word(st, 0), "subnet") == 0 ) {
+    if ( st->words < 2 )
+      return SCOPE_OTHER;
+    ps->subnet = subnet_put(config, stmt_word(st, 1),
+			    ( st->words > 3 && strcmp(stmt_word(st, 2), "netmask") == 0 ) ?
+			    stmt_word(st, 3) : "");
+    ps->host = NULL;
+    return SCOPE_SUBNET;
+  }
+  if ( strcmp(stmt_word(st, 0), "include") == 0 ) {
+    /* include "file"; at top level or in a subnet, not in hosts */
+    if ( st->words == 2 && ps->host == NULL ) {
+      value = stmt_word(st, 1);
+      if ( value[0] == '"' && strlen(value) > 1 && value[strlen(value) - 1] == '"' ) {
+	st->word[1][strlen(value) - 1] = 0x00; /* NULL */
+	value++;
+      }
+      include_add(config, value, ps->subnet);
+    }
+    return SCOPE_OTHER;
+  }
+  if ( strcmp(stmt_word(st, 0), "host") == 0 ) {
+    /* hosts out of subnets are not handled */
+    if ( st->words < 2 || ps->subnet == NULL )
+      return SCOPE_OTHER;
+    ps->host = host_put(config, ps->subnet, stmt_word(st, 1), NULL, NULL);
+    return SCOPE_HOST;
+  }
+  is_option = strcmp(stmt_word(st, 0), "option") == 0;
+  /* keywords joined with its argument */
+  if ( st->words > 1 &&
+       ( ( strcmp(stmt_word(st, 0), "hardware") == 0 &&
+	   strcmp(stmt_word(st, 1), "ethernet") == 0 ) || is_option ) )
+    vstart = 2;
+  /* upload to memory just statements with a value, but authoritative */
+  if ( vstart >= st->words && ! ( st->words == 1 && strcmp(stmt_word(st, 0), "authoritative") == 0 ) )
+    return SCOPE_OTHER;
+  value = ( vstart < st->words ) ? stmt_join(st, vstart, st->words, ' ') : "";
+  key = stmt_join(st, 0, vstart, '+');
+  if ( ps->host != NULL ) {
+    if ( strcmp(key, "hardware+ethernet") == 0 ) {
+      host_set(config, ps->host, value, NULL);
+      return SCOPE_OTHER;
+    }
+    if ( strcmp(key, "fixed-address") == 0 ) {
+      host_set(config, ps->host, NULL, value);
+      return SCOPE_OTHER;
+    }
+    pl = &ps->host->params;
+  } else if ( ps->subnet != NULL ) {
+    pl = &ps->subnet->params;
+  } else {
+    /* global options are not handled */
+    if ( is_option )
+      return SCOPE_OTHER;
+    pl = &config->globals;
+  }
+  if ( strcmp(key, "range") == 0 )
+    param_put_range(config, pl, value);
+  else
+    param_put(config, pl, key, value);
+#if defined( _DEBUG ) && !defined( _INFO )
+  printf("%s%s%s%s%s=%s\n",
+	 ( ps->subnet != NULL ) ? ps->subnet->network : "", ( ps->subnet != NULL ) ? "/" : "",
+	 ( ps->host != NULL ) ? ps->host->name : "", ( ps->host != NULL ) ? "/" : "",
+	 ( strcmp(key, "range") == 0 ) ? pl->last->name : key, value);
+#endif
+  return SCOPE_OTHER;
+}
+
+/* Parse the statements of buf..end into config, starting inside scope
+ * when it is not NULL.  The statement left open at end is put too, as
+ * the end of the file closes it.
+ */
+static void parse_chunk (struct dhcpd_conf *config, char *buf, char *end, struct dhcpd_subnet *scope) {
+  enum dhcpd_token tk;
+  enum dhcpd_scope sc;
+  struct dhcpd_lexer lx;
+  struct dhcpd_statement st;
+  struct dhcpd_parser ps;
+  lx.p = buf;
+  lx.end = end;
+  lx.pending = EOF;
+  memset(&st, 0, sizeof(struct dhcpd_statement));
+  memset(&ps, 0, sizeof(struct dhcpd_parser));
+  ps.subnet = scope;
+  while ( ( tk = lex_next(&lx) ) != TOK_EOF ) {
+    switch (tk) {
+    case TOK_SEMICOLON :
+      parse_statement(config, &ps, &st);
+      break;
+    case TOK_LBRACE :
+      sc = parse_statement(config, &ps, &st);
+      if ( ps.depth < DHCPD_MAXDEPTH )
+	ps.scope[ps.depth] = sc;
+      ps.depth++;
+      break;
+    case TOK_RBRACE :
+      parse_statement(config, &ps, &st);
+      if ( ps.depth > 0 && --ps.depth < DHCPD_MAXDEPTH ) {
+	if ( ps.scope[ps.depth] == SCOPE_SUBNET )
+	  ps.subnet = NULL;
+	if ( ps.scope[ps.depth] != SCOPE_OTHER )
+	  ps.host = NULL;
+      }
+      break;
+    default :
+      stmt_push(&st, lx.tok);
+      continue;
+    }
+    st.words = 0;
+  }
+  parse_statement(config, &ps, &st);
+  free(st.word);
+}
+
+/* Parallel load.  Top-level statements do not depend on each other
+ * once their blocks are closed, so the file is cut there in chunks,
+ * each one parsed by a thread into a configuration of its own, and the
+ * chunks are merged in file order afterwards, giving the same model as
+ * one pass.
+ */
+#define PARSE_CHUNK   65536  /* bytes at least in each chunk */
+#define MAXTHREADS    16
+
+int worker_threads = 0;   /* threads to load and save, 0: one per online CPU */
+
+static int worker_count (void) {
+  long n = ( worker_threads > 0 ) ? worker_threads : sysconf(_SC_NPROCESSORS_ONLN);
+  if ( n < 1 )
+    return 1;
+  return ( n > MAXTHREADS ) ? MAXTHREADS : n;
+}
+
+/* Run fn(arg) on nthreads threads, this one included, and wait for
+ * all of them.  Returns how many threads could be started.
+ */
+static int run_workers (int nthreads, void *(*fn) (void *), void *arg) {
+  pthread_t tid[MAXTHREADS];
+  int i, started = 0;
+  for ( i = 1; i < nthreads && i < MAXTHREADS; i++ )
+    if ( pthread_create(&tid[started], NULL, fn, arg) == 0 )
+      started++;
+  fn(arg);
+  for ( i = 0; i < started; i++ )
+    pthread_join(tid[i], NULL);
+  return started + 1;
+}
+
+static inline int is_word (const char *p, const char *word, size_t len) {
+  return strncmp(p, word, len) == 0 && lex_isdelim((unsigned char) p[len]);
+}
+
+/* Cut buf in up to n chunks of about the same size at the end of
+ * top-level statements, or of statements right inside a top-level
+ * shared-network which is parsed the same, skipping comments and
+ * quoted strings as lex_next does.  A subnet or host statement closed without block, or
+ * too deep blocks, leave the parser in that scope after the statement,
+ * then the file is kept whole.  Returns the number of chunks, cut[i]
+ * is the end of chunk i.
+ */
+static int split_chunks (char *buf, size_t size, char **cut, int n) {
+  char *p, *end = buf + size, *last = buf, *word = NULL;
+  int depth = 0, count = 0, shared = 0;
+  size_t want;
+  if ( (size_t) n > size / PARSE_CHUNK )
+    n = size / PARSE_CHUNK;
+  if ( n <= 1 ) {
+    cut[0] = end;
+    return 1;
+  }
+  want = size / n;
+  for ( p = buf; p < end; p++ ) {
+    switch (*p) {
+    case '#' :
+      if ( ( p = memchr(p, '\n', end - p) ) == NULL )
+	p = end - 1;
+      break;
+    case '"' :
+      if ( word == NULL )
+	word = p;
+      for ( p++; p < end && *p != '"'; p++ )
+	if ( *p == '\\' )
+	  p++;
+      if ( p >= end )
+	p = end - 1;
+      break;
+    case '{' :
+      if ( depth == 0 )
+	shared = word != NULL && is_word(word, "shared-network", 14);
+      if ( ++depth >= DHCPD_MAXDEPTH ) {
+	cut[0] = end;
+	return 1;
+      }
+      word = NULL;
+      break;
+    case ';' :
+    case '}' :
+      if ( word != NULL && ( is_word(word, "subnet", 6) || is_word(word, "host", 4) ) ) {
+	cut[0] = end;
+	return 1;
+      }
+      word = NULL;
+      if ( *p == '}' && depth > 0 )
+	depth--;
+      if ( ( depth == 0 || ( depth == 1 && shared ) ) && (size_t) ( p + 1 - last ) >= want &&
+	   count < n - 1 )
+	last = cut[count++] = p + 1;
+      break;
+    default :
+      if ( word == NULL && ! lex_isspace((unsigned char) *p) )
+	word = p;
+    }
+  }
+  cut[count++] = end;
+  return count;
+}
+
+struct parse_job {
+  pthread_mutex_t lock;
+  int next, count;
+  char *buf;
+  char **cut;
+  struct conf_file *file;
+  struct dhcpd_conf **part;
+};
+
+/* Take the next chunk until there are none left. */
+static void *parse_worker (void *arg) {
+  struct parse_job *job = arg;
+  int i;
+  for ( ;; ) {
+    pthread_mutex_lock(&job->lock);
+    i = job->next++;
+    pthread_mutex_unlock(&job->lock);
+    if ( i >= job->count )
+      return NULL;
+    job->part[i] = new_conf();
+    job->part[i]->file = job->file;
+    parse_chunk(job->part[i], ( i > 0 ) ? job->cut[i - 1] : job->buf, job->cut[i], NULL);
+  }
+}
+
+/* Put params of a chunk the way parse_statement does, ranges take the
+ * next numbers of the list they go to.
+ */
+static void params_merge (struct dhcpd_conf *config, struct dhcpd_params *dst,
+			  struct dhcpd_params *src) {
+  struct dhcpd_param *pa;
+  for ( pa = src->first; pa != NULL; pa = pa->next ) {
+    if ( param_is_range(pa) )
+      param_put_range(config, dst, pa->value);
+    else
+      param_put(config, dst, pa->name, pa->value);
+  }
+}
+
+/* Merge a chunk into config and free it.  Subnets not seen before,
+ * almost all of them, are moved as they are with their hosts, the
+ * strings stay in the chunk arena which is taken by config.
+ */
+static void conf_merge (struct dhcpd_conf *config, struct dhcpd_conf *part) {
+  struct subnet_view *sv = &config->sorted;
+  struct dhcpd_subnet *sn, *next, *dsn;
+  struct dhcpd_host *ho, *dho;
+  struct conf_include *inc;
+  struct arena ar;
+  long i;
+  params_merge(config, &config->globals, &part->globals);
+  for ( sn = part->subnets; sn != NULL; sn = next ) {
+    next = sn->next;
+    i = subnet_lower(sv, sn->has_net, sn->net, sn->network);
+    if ( i == sv->count || subnet_cmp(sn->has_net, sn->net, sn->network, sv->subnet[i]) != 0 ) {
+      subnet_link(config, sn, i);
+      for ( ho = sn->hosts; ho != NULL; ho = ho->next ) {
+	ho->seq = ++config->host_seq;
+	index_add(&config->by_name, ho, KEY_NAME);
+	if ( ho->has_mac )
+	  index_add(&config->by_mac, ho, KEY_MAC);
+	if ( ho->has_ip )
+	  index_add(&config->by_ip, ho, KEY_IP);
+      }
+      config->nhosts += sn->nhosts;
+      continue;
+    }
+    dsn = sv->subnet[i];
+    dsn->netmask = sn->netmask;
+    params_merge(config, &dsn->params, &sn->params);
+    for ( ho = sn->hosts; ho != NULL; ho = ho->next ) {
+      dho = host_put(config, dsn, ho->name, ho->hardware, ho->address);
+      params_merge(config, &dho->params, &ho->params);
+    }
+  }
+  /* includes in subnets seen before point to the merged subnet */
+  for ( inc = part->includes; inc != NULL; inc = inc->next )
+    if ( inc->scope != NULL )
+      inc->scope = subnet_get(config, inc->scope->network);
+  if ( part->includes != NULL ) {
+    if ( config->includes_last != NULL )
+      config->includes_last->next = part->includes;
+    else
+      config->includes = part->includes;
+    config->includes_last = part->includes_last;
+  }
+  ar = part->arena;
+  free(part->sorted.subnet);
+  free(part->by_mac.bucket);
+  free(part->by_ip.bucket);
+  free(part->by_name.bucket);
+  arena_adopt(&config->arena, &ar);
+}
+
+/* Backup store.  Every save keeps the previous dhcpd.conf as a snapshot
+ * in <file>.backups/: a symlink named like the old full copies
+ * (dhcpd.conf-YYYYMMDD-HHMMSS) pointing to objects/<hash>, a blob named
+ * by the hash of its content.  Blobs are zlib compressed, whole or as
+ * a delta of the snapshot before, so identical saves share one blob
+ * and small edits take a few bytes.
+ */
+#define STORE_SUFFIX     ".backups"
+#define STORE_OBJECTS    "objects"
+#define STORE_MAGIC      "DTUI-BLOB"
+#define STORE_MAXDEPTH   8   /* deltas in a row before a whole blob */
+#define STORE_KEEPALL    7   /* days every snapshot is kept */
+#define STORE_KEEPDAILY  60  /* days the last one of each day is kept, then one a week */
+
+struct blob_head {
+  int delta, depth;
+  size_t size, prefix, suffix, skip;
+  char base[25];
+};
+
+/* 96 bits of FNV-1a and CRC-32 as 24 hex digits. */
+static void store_hash (const char *data, size_t len, char *hex) {
+  uint64_t h = 14695981039346656037ULL;
+  size_t i;
+  for ( i = 0; i < len; i++ ) {
+    h ^= (unsigned char) data[i];
+    h *= 1099511628211ULL;
+  }
+  snprintf(hex, 25, "%016llx%08lx", (unsigned long long) h,
+	   (unsigned long) crc32(0L, (const Bytef *) data, len));
+}
+
+static int blob_head_parse (const char *buf, size_t len, struct blob_head *bh) {
+  int n = 0;
+  memset(bh, 0, sizeof(struct blob_head));
+  if ( len < sizeof(STORE_MAGIC) || memcmp(buf, STORE_MAGIC " ", sizeof(STORE_MAGIC)) != 0 ||
+       memchr(buf, '\n', len) == NULL )
+    return 0;
+  if ( sscanf(buf, STORE_MAGIC " full %zu\n%n", &bh->size, &n) == 1 && n > 0 ) {
+    bh->skip = n;
+    return 1;
+  }
+  if ( sscanf(buf, STORE_MAGIC " delta %zu %i %24s %zu %zu\n%n", &bh->size, &bh->depth,
+	      bh->base, &bh->prefix, &bh->suffix, &n) == 5 && n > 0 &&
+       bh->prefix + bh->suffix <= bh->size ) {
+    bh->delta = 1;
+    bh->skip = n;
+    return 1;
+  }
+  return 0;
+}
+
+/* Content of the blob hash, following its delta bases. */
+static char *store_read (const char *objdir, const char *hash, size_t *size, int depth) {
+  struct blob_head bh;
+  size_t len, bsize;
+  uLongf zlen;
+  char *path, *blob, *data, *base;
+  asprintf(&path, "%s/%s", objdir, hash);
+  blob = load_file(path, &len);
+  free(path);
+  if ( blob == NULL )
+    return NULL;
+  if ( depth > STORE_MAXDEPTH || ! blob_head_parse(blob, len, &bh) ) {
+    free(blob);
+    return NULL;
+  }
+  data = xmalloc(bh.size + 1);
+  zlen = bh.size - bh.prefix - bh.suffix;
+  if ( uncompress((Bytef *) data + bh.prefix, &zlen, (Bytef *) blob + bh.skip, len - bh.skip) != Z_OK ||
+       zlen != bh.size - bh.prefix - bh.suffix ) {
+    free(blob);
+    free(data);
+    return NULL;
+  }
+  free(blob);
+  if ( bh.delta ) {
+    if ( ( base = store_read(objdir, bh.base, &bsize, depth + 1) ) == NULL ||
+	 bsize < bh.prefix + bh.suffix ) {
+      free(base);
+      free(data);
+      return NULL;
+    }
+    memcpy(data, base, bh.prefix);
+    memcpy(data + bh.size - bh.suffix, base + bsize - bh.suffix, bh.suffix);
+    free(base);
+  }
+  data[bh.size] = 0x00; /* NULL */
+  *size = bh.size;
+  return data;
+}
+
+/* Depth of the delta chain behind a blob, -1 if it can't be read. */
+static int store_depth (const char *objdir, const char *hash, char *base) {
+  struct blob_head bh;
+  char *path, head[128];
+  ssize_t rd;
+  int fdes;
+  asprintf(&path, "%s/%s", objdir, hash);
+  fdes = open(path, O_RDONLY);
+  free(path);
+  if ( fdes == -1 )
+    return -1;
+  rd = read(fdes, head, sizeof(head) - 1);
+  close(fdes);
+  if ( rd <= 0 )
+    return -1;
+  head[rd] = 0x00; /* NULL */
+  if ( ! blob_head_parse(head, rd, &bh) )
+    return -1;
+  if ( base != NULL )
+    strcpy(base, bh.delta ? bh.base : "");
+  return bh.depth;
+}
+
+/* Write data as blob hash, a delta of base when that is worth it. */
+static int store_write (const char *objdir, const char *hash, const char *data, size_t len,
+			const char *basehash, const char *base, size_t blen, int depth) {
+  size_t prefix = 0, suffix = 0, hlen;
+  uLongf zlen;
+  char *path, *tmpname, *blob;
+  int fdes, rc = EXIT_FAILURE;
+  if ( base != NULL && depth < STORE_MAXDEPTH ) {
+    while ( prefix < len && prefix < blen && data[prefix] == base[prefix] )
+      prefix++;
+    while ( suffix < len - prefix && suffix < blen - prefix &&
+	    data[len - suffix - 1] == base[blen - suffix - 1] )
+      suffix++;
+    if ( len - prefix - suffix > len / 2 )
+      base = NULL;
+  } else {
+    base = NULL;
+  }
+  if ( base == NULL )
+    prefix = suffix = 0;
+  zlen = compressBound(len - prefix - suffix);
+  blob = xmalloc(zlen + 128);
+  if ( base != NULL )
+    hlen = snprintf(blob, 128, STORE_MAGIC " delta %zu %i %s %zu %zu\n",
+		    len, depth + 1, basehash, prefix, suffix);
+  else
+    hlen = snprintf(blob, 128, STORE_MAGIC " full %zu\n", len);
+  if ( compress2((Bytef *) blob + hlen, &zlen, (const Bytef *) data + prefix,
+		 len - prefix - suffix, Z_DEFAULT_COMPRESSION) != Z_OK ) {
+    free(blob);
+    return EXIT_FAILURE;
+  }
+  asprintf(&path, "%s/%s", objdir, hash);
+  asprintf(&tmpname, "%s.XXXXXX", path);
+  if ( ( fdes = mkstemp(tmpname) ) != -1 ) {
+    fchmod(fdes, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    STAT_ADD(C_WRITTEN, hlen + zlen);
+    if ( write(fdes, blob, hlen + zlen) == (ssize_t) ( hlen + zlen ) && fsync(fdes) == 0 &&
+	 close(fdes) == 0 && rename(tmpname, path) == 0 )
+      rc = EXIT_SUCCESS;
+    else
+      unlink(tmpname);
+  }
+  free(blob);
+  free(path);
+  free(tmpname);
+  return rc;
+}
+
+static int snapshot_cmp (const void *a, const void *b) {
+  return strcmp(*(char * const *) b, *(char * const *) a);
+}
+
+/* Snapshot names of a store, newest first. */
+static char **store_snapshots (const char *dir, const char *name, int *count) {
+  DIR *dp;
+  struct dirent *ep;
+  char **snap = NULL;
+  size_t nlen = strlen(name);
+  int size = 0;
+  *count = 0;
+  if ( ( dp = opendir(dir) ) == NULL )
+    return NULL;
+  while ( ( ep = readdir(dp) ) != NULL ) {
+    if ( strncmp(ep->d_name, name, nlen) != 0 || strlen(ep->d_name) != nlen + 16 ||
+	 ep->d_name[nlen] != '-' || ep->d_name[nlen + 9] != '-' )
+      continue;
+    if ( *count == size ) {
+      size = ( size > 0 ) ? 2 * size : 64;
+      snap = xrealloc(snap, sizeof(char *) * size);
+    }
+    snap[(*count)++] = savestring(ep->d_name);
+  }
+  closedir(dp);
+  if ( *count > 0 )
+    qsort(snap, *count, sizeof(char *), snapshot_cmp);
+  return snap;
+}
+
+static time_t snapshot_time (const char *snap, size_t nlen) {
+  struct tm tm;
+  memset(&tm, 0, sizeof(struct tm));
+  if ( sscanf(snap + nlen, "-%4d%2d%2d-%2d%2d%2d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+	      &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6 )
+    return 0;
+  tm.tm_year -= 1900;
+  tm.tm_mon--;
+  tm.tm_isdst = -1;
+  return mktime(&tm);
+}
+
+/* Hash a snapshot points to, "" if it isn't a store snapshot. */
+static void snapshot_hash (const char *dir, const char *snap, char *hash) {
+  char *link, target[PATH_MAX], *h;
+  ssize_t rl;
+  asprintf(&link, "%s/%s", dir, snap);
+  rl = readlink(link, target, sizeof(target) - 1);
+  free(link);
+  hash[0] = 0x00; /* NULL */
+  if ( rl <= 0 )
+    return;
+  target[rl] = 0x00; /* NULL */
+  h = ( ( h = strrchr(target, '/') ) != NULL ) ? h + 1 : target;
+  if ( strlen(h) == 24 )
+    strcpy(hash, h);
+}
+
+static int hash_in (char (*set)[25], int n, const char *hash) {
+  int i;
+  for ( i = 0; i < n && strcmp(set[i], hash) != 0; i++ );
+  return i < n;
+}
+
+/* Keep every snapshot of the last STORE_KEEPALL days, the last one of
+ * each day up to STORE_KEEPDAILY days and the last one of each week
+ * after that.  Kept blobs that are deltas of a dropped one are written
+ * again whole: blobs may already be deltas of them, so their depth
+ * can't grow.  Then the blobs no snapshot needs any more are removed.
+ */
+static int store_prune (const char *dir, const char *objdir, const char *name) {
+  char **snap, *path, *data, *drop, (*keep)[25], hash[25], bhash[25];
+  size_t nlen = strlen(name), len;
+  int nsnap, nkeep = 0, pruned = 0, newest, i;
+  time_t now = time(NULL), t, prev = 0;
+  DIR *dp;
+  struct dirent *ep;
+  if ( ( snap = store_snapshots(dir, name, &nsnap) ) == NULL )
+    return 0;
+  keep = xmalloc(sizeof(*keep) * ( nsnap + 1 ));
+  drop = xmalloc(nsnap);
+  for ( i = 0; i < nsnap; i++, prev = t ) {
+    t = snapshot_time(snap[i], nlen);
+    if ( now - t < STORE_KEEPALL * 86400L )
+      newest = 1;
+    else if ( now - t < STORE_KEEPDAILY * 86400L )
+      newest = ( i == 0 || strncmp(snap[i], snap[i - 1], nlen + 9) != 0 );
+    else
+      newest = ( i == 0 || t / ( 7 * 86400L ) != prev / ( 7 * 86400L ) );
+    if ( ( drop[i] = ! newest ) ) {
+      asprintf(&path, "%s/%s", dir, snap[i]);
+      unlink(path);
+      free(path);
+      pruned++;
+    }
+  }
+  /* kept blobs oldest first, that is in the order they were made */
+  for ( i = nsnap - 1; i >= 0; i-- ) {
+    if ( drop[i] )
+      continue;
+    snapshot_hash(dir, snap[i], hash);
+    if ( hash[0] != 0x00 && ! hash_in(keep, nkeep, hash) )
+      strcpy(keep[nkeep++], hash);
+  }
+  free_double_pointer(snap, nsnap);
+  free(drop);
+  for ( i = 0; pruned > 0 && i < nkeep; i++ ) {
+    if ( store_depth(objdir, keep[i], bhash) <= 0 || hash_in(keep, nkeep, bhash) ||
+	 ( data = store_read(objdir, keep[i], &len, 0) ) == NULL )
+      continue;
+    store_write(objdir, keep[i], data, len, NULL, NULL, 0, 0);
+    free(data);
+  }
+  /* blobs the kept ones are still deltas of */
+  for ( i = 0; i < nkeep; i++ ) {
+    keep = xrealloc(keep, sizeof(*keep) * ( nkeep + 1 ));
+    if ( store_depth(objdir, keep[i], bhash) > 0 && ! hash_in(keep, nkeep, bhash) )
+      strcpy(keep[nkeep++], bhash);
+  }
+  if ( ( dp = opendir(objdir) ) != NULL ) {
+    while ( ( ep = readdir(dp) ) != NULL ) {
+      if ( ep->d_name[0] == '.' || hash_in(keep, nkeep, ep->d_name) )
+	continue;
+      asprintf(&path, "%s/%s", objdir, ep->d_name);
+      unlink(path);
+      free(path);
+    }
+    closedir(dp);
+  }
+  free(keep);
+  return pruned;
+}
+
+/* Load a configuration file, a store snapshot is rebuilt from its
+ * blobs, then *stored is set when it is not NULL.
+ */
+static char *load_config_file (const char *filename, size_t *size, int *stored) {
+  struct blob_head bh;
+  char *buf, *path, *slash;
+  if ( stored != NULL )
+    *stored = 0;
+  if ( ( buf = load_file(filename, size) ) == NULL || ! blob_head_parse(buf, *size, &bh) )
+    return buf;
+  free(buf);
+  if ( stored != NULL )
+    *stored = 1;
+  if ( ( path = realpath(filename, NULL) ) == NULL || ( slash = strrchr(path, '/') ) == NULL ) {
+    free(path);
+    return NULL;
+  }
+  *slash = 0x00; /* NULL */
+  buf = store_read(path, slash + 1, size, 0);
+  free(path);
+  return buf;
+}
+
+/* Backup catalog, <file>.backups/catalog: one fixed size record per
+ * backup, oldest first, so a page of the newest ones is read straight
+ * from the end of the file.  It is made again from the backups when
+ * missing.
+ */
+#define CATALOG_NAME  "catalog"
+#define CATALOG_PAGE  100
+
+struct catalog_entry {
+  int64_t time;
+  uint64_t size;
+  uint32_t nsubnets, nhosts;
+  char hash[32];
+  char path[72]; /* relative to the directory of the configuration */
+};
+
+/* Count the subnet and host blocks, statements starting a line. */
+static void count_blocks (const char *data, size_t len, uint32_t *nsubnets, uint32_t *nhosts) {
+  const char *p = data, *end = data + len;
+  *nsubnets = *nhosts = 0;
+  while ( p < end ) {
+    while ( p < end && ( *p == ' ' || *p == '\t' ) )
+      p++;
+    if ( end - p > 7 && memcmp(p, "subnet", 6) == 0 && ( p[6] == ' ' || p[6] == '\t' ) )
+      (*nsubnets)++;
+    else if ( end - p > 5 && memcmp(p, "host", 4) == 0 && ( p[4] == ' ' || p[4] == '\t' ) )
+      (*nhosts)++;
+    if ( ( p = memchr(p, '\n', end - p) ) == NULL )
+      break;
+    p++;
+  }
+}
+
+static void catalog_entry_set (struct catalog_entry *ce, const char *path, time_t t,
+			       const char *data, size_t len, const char *hash) {
+  memset(ce, 0, sizeof(struct catalog_entry));
+  ce->time = t;
+  ce->size = len;
+  count_blocks(data, len, &ce->nsubnets, &ce->nhosts);
+  if ( hash != NULL )
+    snprintf(ce->hash, sizeof(ce->hash), "%s", hash);
+  else
+    store_hash(data, len, ce->hash);
+  snprintf(ce->path, sizeof(ce->path), "%s", path);
+}
+
+static int catalog_cmp (const void *a, const void *b) {
+  const struct catalog_entry *x = a, *y = b;
+  if ( x->time != y->time )
+    return ( x->time < y->time ) ? -1 : 1;
+  return strcmp(x->path, y->path);
+}
+
+static int catalog_write (const char *catalog, struct catalog_entry *ce, long count) {
+  char *tmpname;
+  int fdes, rc = EXIT_FAILURE;
+  asprintf(&tmpname, "%s.XXXXXX", catalog);
+  if ( ( fdes = mkstemp(tmpname) ) != -1 ) {
+    fchmod(fdes, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    STAT_ADD(C_WRITTEN, sizeof(struct catalog_entry) * count);
+    if ( write(fdes, ce, sizeof(struct catalog_entry) * count) ==
+	 (ssize_t) ( sizeof(struct catalog_entry) * count ) &&
+	 close(fdes) == 0 && rename(tmpname, catalog) == 0 )
+      rc = EXIT_SUCCESS;
+    else
+      unlink(tmpname);
+  }
+  free(tmpname);
+  return rc;
+}
+
+/* Make the catalog of the old full copies next to filename and the
+ * snapshots in its store.
+ */
+static int catalog_rebuild (const char *filename) {
+  const char *name;
+  char *dirpath, *dir[2], *prefix[2], *path, *rel, *data, **snap, *catalog;
+  struct catalog_entry *ce = NULL;
+  long count = 0, size = 0;
+  size_t len;
+  int nsnap, d, i, rc;
+  name = ( ( name = strrchr(filename, '/') ) != NULL ) ? name + 1 : filename;
+  dirpath = savestring(filename);
+  dirpath[name - filename] = 0x00; /* NULL */
+  asprintf(&dir[0], "%s.", dirpath);
+  asprintf(&dir[1], "%s" STORE_SUFFIX, filename);
+  prefix[0] = "";
+  asprintf(&prefix[1], "%s" STORE_SUFFIX "/", name);
+  for ( d = 0; d < 2; d++ ) {
+    if ( ( snap = store_snapshots(dir[d], name, &nsnap) ) == NULL )
+      continue;
+    for ( i = 0; i < nsnap; i++ ) {
+      asprintf(&rel, "%s%s", prefix[d], snap[i]);
+      asprintf(&path, "%s%s", dirpath, rel);
+      if ( ( data = load_config_file(path, &len, NULL) ) != NULL ) {
+	if ( count == size ) {
+	  size = ( size > 0 ) ? 2 * size : 256;
+	  ce = xrealloc(ce, sizeof(struct catalog_entry) * size);
+	}
+	catalog_entry_set(&ce[count++], rel, snapshot_time(snap[i], strlen(name)), data, len, NULL);
+	free(data);
+      }
+      free(path);
+      free(rel);
+    }
+    free_double_pointer(snap, nsnap);
+  }
+  if ( count > 0 )
+    qsort(ce, count, sizeof(struct catalog_entry), catalog_cmp);
+  asprintf(&catalog, "%s/" CATALOG_NAME, dir[1]);
+  rc = catalog_write(catalog, ce, count);
+  free(catalog);
+  free(ce);
+  free(dir[0]);
+  free(dir[1]);
+  free(prefix[1]);
+  free(dirpath);
+  return rc;
+}
+
+/* Append the record of a new backup, one made again in the same
+ * second replaces the last record.
+ */
+static void catalog_add (const char *filename, struct catalog_entry *ce) {
+  struct catalog_entry last;
+  struct stat sb;
+  char *catalog;
+  off_t at;
+  int fdes;
+  asprintf(&catalog, "%s" STORE_SUFFIX "/" CATALOG_NAME, filename);
+  if ( ( fdes = open(catalog, O_RDWR) ) == -1 || fstat(fdes, &sb) == -1 ) {
+    /* the new backup is already on disk */
+    if ( fdes != -1 )
+      close(fdes);
+    free(catalog);
+    catalog_rebuild(filename);
+    return;
+  }
+  at = sb.st_size - sb.st_size % sizeof(struct catalog_entry);
+  if ( at > 0 && pread(fdes, &last, sizeof(last), at - sizeof(last)) == sizeof(last) &&
+       strcmp(last.path, ce->path) == 0 )
+    at -= sizeof(last);
+  STAT_ADD(C_WRITTEN, sizeof(struct catalog_entry));
+  if ( pwrite(fdes, ce, sizeof(struct catalog_entry), at) != sizeof(struct catalog_entry) ||
+       ftruncate(fdes, at + sizeof(struct catalog_entry)) == -1 ) {
+    close(fdes);
+    unlink(catalog);
+    free(catalog);
+    return;
+  }
+  close(fdes);
+  free(catalog);
+}
+
+/* Drop the records of backups removed by the retention. */
+static void catalog_prune (const char *filename) {
+  const char *name;
+  char *catalog, *buf, *path;
+  struct catalog_entry *ce;
+  struct stat sb;
+  size_t len;
+  long count, i, kept = 0;
+  name = ( ( name = strrchr(filename, '/') ) != NULL ) ? name + 1 : filename;
+  asprintf(&catalog, "%s" STORE_SUFFIX "/" CATALOG_NAME, filename);
+  if ( ( buf = load_file(catalog, &len) ) == NULL ) {
+    free(catalog);
+    return;
+  }
+  ce = (struct catalog_entry *) buf;
+  count = len / sizeof(struct catalog_entry);
+  for ( i = 0; i < count; i++ ) {
+    asprintf(&path, "%.*s%s", (int) ( name - filename ), filename, ce[i].path);
+    if ( lstat(path, &sb) == 0 )
+      ce[kept++] = ce[i];
+    free(path);
+  }
+  if ( kept < count )
+    catalog_write(catalog, ce, kept);
+  free(buf);
+  free(catalog);
+}
+
+/* Page of catalog records, newest first.  Returns how many were read
+ * and the number of records in *total.
+ */
+static long catalog_read (const char *filename, long page, struct catalog_entry *ce, long *total) {
+  char *catalog;
+  struct catalog_entry tmp;
+  struct stat sb;
+  long first, last, count, i;
+  int fdes;
+  *total = 0;
+  asprintf(&catalog, "%s" STORE_SUFFIX "/" CATALOG_NAME, filename);
+  if ( ( fdes = open(catalog, O_RDONLY) ) == -1 && catalog_rebuild(filename) == EXIT_SUCCESS )
+    fdes = open(catalog, O_RDONLY);
+  free(catalog);
+  if ( fdes == -1 )
+    return 0;
+  if ( fstat(fdes, &sb) == -1 ) {
+    close(fdes);
+    return 0;
+  }
+  *total = sb.st_size / sizeof(struct catalog_entry);
+  last = *total - page * CATALOG_PAGE;
+  first = ( last > CATALOG_PAGE ) ? last - CATALOG_PAGE : 0;
+  count = ( last > first ) ? last - first : 0;
+  if ( count > 0 && pread(fdes, ce, sizeof(struct catalog_entry) * count,
+			  sizeof(struct catalog_entry) * first) != (ssize_t) ( sizeof(struct catalog_entry) * count ) )
+    count = 0;
+  close(fdes);
+  for ( i = 0; i < count / 2; i++ ) {
+    tmp = ce[i];
+    ce[i] = ce[count - 1 - i];
+    ce[count - 1 - i] = tmp;
+  }
+  return count;
+}
+
+/* Keep the current content of filename as the snapshot filename+suffix
+ * in its store and catalog, unless it is the same as the last snapshot.
+ */
+int backup_store (const char *filename, const char *suffix) {
+  const char *name;
+  char *dir, *objdir, *path, *link, *target, *data, *base = NULL, **snap;
+  char hash[25], basehash[25] = "";
+  size_t len, blen = 0;
+  int nsnap, depth = 0, rc = EXIT_FAILURE;
+  struct stat sb;
+  struct catalog_entry ce;
+  name = ( ( name = strrchr(filename, '/') ) != NULL ) ? name + 1 : filename;
+  asprintf(&dir, "%s" STORE_SUFFIX, filename);
+  asprintf(&objdir, "%s/" STORE_OBJECTS, dir);
+  if ( ( mkdir(dir, 0755) == -1 && errno != EEXIST ) ||
+       ( mkdir(objdir, 0755) == -1 && errno != EEXIST ) ||
+       ( data = load_file(filename, &len) ) == NULL ) {
+    free(dir);
+    free(objdir);
+    return EXIT_FAILURE;
+  }
+  store_hash(data, len, hash);
+  if ( ( snap = store_snapshots(dir, name, &nsnap) ) != NULL ) {
+    snapshot_hash(dir, snap[0], basehash);
+    free_double_pointer(snap, nsnap);
+  }
+  if ( strcmp(basehash, hash) == 0 ) {
+    /* nothing changed since the last snapshot */
+    free(data);
+    free(dir);
+    free(objdir);
+    return EXIT_SUCCESS;
+  }
+  asprintf(&path, "%s/%s", objdir, hash);
+  if ( stat(path, &sb) == -1 ) {
+    if ( basehash[0] != 0x00 && ( depth = store_depth(objdir, basehash, NULL) ) >= 0 )
+      base = store_read(objdir, basehash, &blen, 0);
+    rc = store_write(objdir, hash, data, len, basehash, base, blen, depth);
+    free(base);
+  } else {
+    rc = EXIT_SUCCESS;
+  }
+  if ( rc == EXIT_SUCCESS ) {
+    asprintf(&link, "%s/%s%s", dir, name, suffix);
+    asprintf(&target, STORE_OBJECTS "/%s", hash);
+    unlink(link);
+    if ( symlink(target, link) == -1 ) {
+      rc = EXIT_FAILURE;
+    } else {
+      nsnap = store_prune(dir, objdir, name);
+      free(link);
+      asprintf(&link, "%s" STORE_SUFFIX "/%s%s", name, name, suffix);
+      catalog_entry_set(&ce, link, snapshot_time(strrchr(link, '/') + 1, strlen(name)), data, len, hash);
+      catalog_add(filename, &ce);
+      if ( nsnap > 0 )
+	catalog_prune(filename);
+    }
+    free(link);
+    free(target);
+  }
+  free(path);
+  free(data);
+  free(dir);
+  free(objdir);
+  return rc;
+}
+
+/* Seconds spent by each step of the last load, and how it was split. */
+struct load_times {
+  double read, parse, merge;
+  int threads, chunks, files, cached;
+  int model;                 /* taken from the model cache */
+} last_load;
+
+static double lap (struct timespec *t) {
+  struct timespec now;
+  double d;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  d = ( now.tv_sec - t->tv_sec ) + ( now.tv_nsec - t->tv_nsec ) / 1e9;
+  *t = now;
+  return d;
+}
+
+/* Parse a whole file into config, big ones are parsed in chunks by
+ * several threads, see split_chunks.  A file included in a subnet is
+ * parsed whole inside it.
+ */
+static void parse_buffer (struct dhcpd_conf *config, char *buf, size_t size,
+			  struct dhcpd_subnet *scope, struct timespec *t) {
+  char *cut[MAXTHREADS * 4];
+  int nthreads, nchunks, i;
+  struct dhcpd_conf *part[MAXTHREADS * 4];
+  struct parse_job job;
+  nthreads = worker_count();
+#if defined( _DEBUG ) && !defined( _INFO )
+  /* statements are traced in file order */
+  nthreads = 1;
+#endif
+  nchunks = ( nthreads > 1 && scope == NULL ) ? split_chunks(buf, size, cut, nthreads * 4) : 1;
+  if ( nchunks == 1 ) {
+    nthreads = 1;
+    parse_chunk(config, buf, buf + size, scope);
+    last_load.parse += lap(t);
+  } else {
+    job.next = 0;
+    job.count = nchunks;
+    job.buf = buf;
+    job.cut = cut;
+    job.file = config->file;
+    job.part = part;
+    pthread_mutex_init(&job.lock, NULL);
+    nthreads = run_workers(( nthreads < nchunks ) ? nthreads : nchunks, parse_worker, &job);
+    pthread_mutex_destroy(&job.lock);
+    last_load.parse += lap(t);
+    for ( i = 0; i < nchunks; i++ )
+      conf_merge(config, part[i]);
+    last_load.merge += lap(t);
+  }
+  if ( nthreads > last_load.threads )
+    last_load.threads = nthreads;
+  last_load.chunks += nchunks;
+}
+
+/* Included files.  Every file loaded has one entry here for the life
+ * of the program, an included file keeps its statements parsed in a
+ * configuration of its own, which is used again while its inode, mtime
+ * and size stay the same, so loading again only parses the files which
+ * changed.  Names not starting with '/' are taken from DEFPATH, they
+ * may be glob patterns.
+ */
+#define INCLUDE_MAXDEPTH  8
+
+struct conf_file {
+  char *path;
+  dev_t dev;
+  ino_t ino;
+  struct timespec mtime;
+  off_t size;
+  uint32_t crc;              /* CRC-32 of the content loaded */
+  char *scope;               /* network of the subnet it was parsed in */
+  struct dhcpd_conf *part;   /* parsed statements, never for dhcpd.conf */
+  struct conf_file *next;
+};
+
+static struct conf_file *file_cache;
+
+static struct conf_file *file_entry (const char *path) {
+  struct conf_file *cf;
+  for ( cf = file_cache; cf != NULL; cf = cf->next )
+    if ( strcmp(cf->path, path) == 0 )
+      return cf;
+  cf = xmalloc(sizeof(struct conf_file));
+  memset(cf, 0, sizeof(struct conf_file));
+  cf->path = savestring(path);
+  cf->next = file_cache;
+  file_cache = cf;
+  return cf;
+}
+
+static int file_fresh (struct conf_file *cf, struct stat *sb, const char *scope) {
+  return cf->part != NULL && cf->dev == sb->st_dev && cf->ino == sb->st_ino &&
+    cf->size == sb->st_size && cf->mtime.tv_sec == sb->st_mtim.tv_sec &&
+    cf->mtime.tv_nsec == sb->st_mtim.tv_nsec &&
+    ( ( cf->scope == NULL && scope == NULL ) ||
+      ( cf->scope != NULL && scope != NULL && strcmp(cf->scope, scope) == 0 ) );
+}
+
+/* Cache entries are shared by every loaded configuration, so the slot
+ * of a file is kept in a map of the configuration itself.
+ */
+static inline unsigned file_hash (struct dhcpd_conf *config, struct conf_file *cf) {
+  return ( (uint64_t) (uintptr_t) cf * 0x9E3779B97F4A7C15ULL ) >> 32 & ( config->file_mapsz - 1 );
+}
+
+static void file_map_put (struct dhcpd_conf *config, int slot) {
+  unsigned h = file_hash(config, config->files[slot]);
+  while ( config->file_map[h] != -1 )
+    h = ( h + 1 ) & ( config->file_mapsz - 1 );
+  config->file_map[h] = slot;
+}
+
+static void file_add (struct dhcpd_conf *config, struct conf_file *cf) {
+  int i;
+  if ( ( config->nfiles & ( config->nfiles - 1 ) ) == 0 )
+    config->files = xrealloc(config->files, sizeof(struct conf_file *) *
+			     ( ( config->nfiles > 0 ) ? 2 * config->nfiles : 1 ));
+  config->files[config->nfiles++] = cf;
+  if ( 2 * config->nfiles > config->file_mapsz ) {
+    config->file_mapsz = ( config->file_mapsz > 0 ) ? 2 * config->file_mapsz : 8;
+    config->file_map = xrealloc(config->file_map, sizeof(int) * config->file_mapsz);
+    memset(config->file_map, 0xff, sizeof(int) * config->file_mapsz);
+    for ( i = 0; i < config->nfiles; i++ )
+      file_map_put(config, i);
+  } else {
+    file_map_put(config, config->nfiles - 1);
+  }
+}
+
+void file_cache_free (void) {
+  struct conf_file *cf, *next;
+  for ( cf = file_cache; cf != NULL; cf = next ) {
+    next = cf->next;
+    if ( cf->part != NULL )
+      destroy_conf(cf->part);
+    free(cf->scope);
+    free(cf->path);
+    free(cf);
+  }
+  file_cache = NULL;
+}
+
+/* Put the statements of an included file into config, copied so the
+ * file keeps them for the next load.  Its first subnet stands for the
+ * one it is included in.
+ */
+static void conf_copy (struct dhcpd_conf *config, struct conf_file *cf, struct dhcpd_subnet *scope) {
+  struct dhcpd_conf *part = cf->part;
+  struct dhcpd_subnet *sn, *dsn;
+  struct dhcpd_host *ho, *dho;
+  struct conf_include *inc;
+  config->file = cf;
+  params_merge(config, &config->globals, &part->globals);
+  for ( sn = part->subnets; sn != NULL; sn = sn->next ) {
+    if ( scope != NULL && sn == part->subnets )
+      dsn = scope;
+    else
+      dsn = subnet_put(config, sn->network, sn->netmask);
+    params_merge(config, &dsn->params, &sn->params);
+    for ( ho = sn->hosts; ho != NULL; ho = ho->next ) {
+      dho = host_put(config, dsn, ho->name, ho->hardware, ho->address);
+      params_merge(config, &dho->params, &ho->params);
+    }
+  }
+  for ( inc = part->includes; inc != NULL; inc = inc->next )
+    include_add(config, inc->name, ( inc->scope == NULL ) ? NULL :
+		( scope != NULL && inc->scope == part->subnets ) ? scope :
+		subnet_get(config, inc->scope->network));
+  config->file = NULL;
+}
+
+static void load_includes (struct dhcpd_conf *config, struct conf_file *cf, int depth,
+			   struct timespec *t);
+
+static void load_included (struct dhcpd_conf *config, const char *path, struct dhcpd_subnet *scope,
+			   int depth, struct timespec *t) {
+  struct stat sb;
+  struct conf_file *cf;
+  struct dhcpd_subnet *placeholder = NULL;
+  const char *network = ( scope != NULL ) ? scope->network : NULL;
+  size_t size;
+  char *buf;
+  int i;
+  if ( stat(path, &sb) == -1 || ! S_ISREG(sb.st_mode) )
+    return;
+  /* loaded already, or an include loop */
+  for ( i = 0; i < config->nfiles; i++ )
+    if ( config->files[i]->dev == sb.st_dev && config->files[i]->ino == sb.st_ino )
+      return;
+  cf = file_entry(path);
+  if ( file_fresh(cf, &sb, network) ) {
+    last_load.cached++;
+  } else {
+    if ( cf->part != NULL )
+      destroy_conf(cf->part);
+    cf->part = NULL;
+    if ( ( buf = load_file(path, &size) ) == NULL )
+      return;
+    cf->crc = crc32(0L, (const Bytef *) buf, size);
+    last_load.read += lap(t);
+    cf->part = new_conf();
+    cf->part->file = cf;
+    if ( network != NULL )
+      placeholder = subnet_put(cf->part, network, scope->netmask);
+    parse_buffer(cf->part, buf, size, placeholder, t);
+    cf->part->file = NULL;
+    free(buf);
+    free(cf->scope);
+    cf->scope = ( network != NULL ) ? savestring(network) : NULL;
+  }
+  cf->dev = sb.st_dev;
+  cf->ino = sb.st_ino;
+  cf->size = sb.st_size;
+  cf->mtime = sb.st_mtim;
+  file_add(config, cf);
+  conf_copy(config, cf, scope);
+  last_load.merge += lap(t);
+  load_includes(config, cf, depth + 1, t);
+}
+
+/* Load the files named by the include statements of cf, in order. */
+static void load_includes (struct dhcpd_conf *config, struct conf_file *cf, int depth,
+			   struct timespec *t) {
+  struct conf_include *inc;
+  glob_t gl;
+  char *pattern;
+  size_t i;
+  if ( depth > INCLUDE_MAXDEPTH )
+    return;
+  for ( inc = config->includes; inc != NULL; inc = inc->next ) {
+    if ( inc->parent != cf )
+      continue;
+    if ( inc->name[0] == '/' )
+      pattern = savestring(inc->name);
+    else
+      asprintf(&pattern, DEFPATH "%s", inc->name);
+    if ( glob(pattern, 0, NULL, &gl) == 0 ) {
+      for ( i = 0; i < gl.gl_pathc; i++ )
+	load_included(config, gl.gl_pathv[i], inc->scope, depth, t);
+      globfree(&gl);
+    }
+    free(pattern);
+  }
+}
+
+/* Output buffer, it grows geometrically so appending is linear in the
+ * size of the generated file.
+ */
+struct outbuf {
+  char *data;
+  size_t len, size;
+};
+
+static void ob_init (struct outbuf *ob, size_t size) {
+  ob->size = ( size > 0 ) ? size : BUFSIZ;
+  ob->data = xmalloc(ob->size);
+  ob->data[0] = 0x00; /* NULL */
+  ob->len = 0;
+}
+
+static void ob_reserve (struct outbuf *ob, size_t len) {
+  if ( ob->size == 0 )
+    ob_init(ob, 0);
+  if ( ob->len + len + 1 <= ob->size )
+    return;
+  while ( ob->len + len + 1 > ob->size )
+    ob->size *= 2;
+  ob->data = xrealloc(ob->data, ob->size);
+}
+
+static void ob_write (struct outbuf *ob, const char *s, size_t len) {
+  ob_reserve(ob, len);
+  memcpy(ob->data + ob->len, s, len);
+  ob->len += len;
+  ob->data[ob->len] = 0x00; /* NULL */
+}
+
+static void ob_puts (struct outbuf *ob, const char *s) {
+  ob_write(ob, s, strlen(s));
+}
+
+static void ob_printf (struct outbuf *ob, const char *fmt, ...) {
+  va_list ap;
+  int len;
+  if ( ob->size == 0 )
+    ob_init(ob, 0);
+  va_start (ap, fmt);
+  len = vsnprintf(ob->data + ob->len, ob->size - ob->len, fmt, ap);
+  va_end (ap);
+  if ( len < 0 )
+    return;
+  if ( ob->len + len + 1 > ob->size ) {
+    ob_reserve(ob, len);
+    va_start (ap, fmt);
+    vsnprintf(ob->data + ob->len, ob->size - ob->len, fmt, ap);
+    va_end (ap);
+  }
+  ob->len += len;
+}
+
+static void ob_free (struct outbuf *ob) {
+  free(ob->data);
+  ob->data = NULL;
+  ob->len = ob->size = 0;
+}
+
+/* Slot of a file in config, the main file for unknown ones. */
+static inline int file_slot (struct dhcpd_conf *config, struct conf_file *cf) {
+  unsigned h;
+  if ( cf == NULL || config->file_mapsz == 0 )
+    return 0;
+  for ( h = file_hash(config, cf); config->file_map[h] != -1; h = ( h + 1 ) & ( config->file_mapsz - 1 ) )
+    if ( config->files[config->file_map[h]] == cf )
+      return config->file_map[h];
+  return 0;
+}
+
+/* Write every buffer, writev may stop anywhere in the middle. */
+static int write_iov (int fdes, struct iovec *iov, int iovcnt) {
+  ssize_t wr;
+  while ( iovcnt > 0 ) {
+    if ( ( wr = writev(fdes, iov, iovcnt) ) == -1 ) {
+      if ( errno == EINTR )
+	continue;
+      return -1;
+    }
+    STAT_ADD(C_WRITTEN, wr);
+    for ( ; iovcnt > 0 && (size_t) wr >= iov->iov_len; iov++, iovcnt-- )
+      wr -= iov->iov_len;
+    if ( iovcnt > 0 ) {
+      iov->iov_base = (char *) iov->iov_base + wr;
+      iov->iov_len -= wr;
+    }
+  }
+  return 0;
+}
+
+/* Model cache, <file>.backups/model: the loaded configuration as fixed
+ * size records and a string table, mapped back instead of parsing while
+ * every file keeps its size, mtime and CRC-32 and no new file matches
+ * an include.  Strings of the model point into the private mapping.  A
+ * short, damaged or stale cache is just ignored and the files parsed.
+ * Only loads of the edited file write it, a diff or a restore of any
+ * other file leaves nothing behind.
+ */
+#define MODEL_NAME     "model"
+#define MODEL_MAGIC    "DTUIMODL"
+#define MODEL_VERSION  1
+#define MODEL_NONE     0xffffffffU
+
+const char *model_config = DEFCONFIG;   /* the file whose loads write the cache */
+
+struct model_head {
+  char magic[8];
+  uint32_t version, crc;      /* crc of everything after the head */
+  uint64_t length, strings;   /* whole file, string table at its end */
+  uint32_t nfiles, nincludes, nsubnets, nhosts;
+  uint32_t nparams, nglobals, globals_rid, pad;
+};
+
+struct model_file {
+  uint32_t path, scope, crc, pad;
+  int64_t size, mtime, mtime_nsec;
+};
+
+struct model_include {
+  uint32_t name, parent, scope, pad;
+};
+
+struct model_subnet {
+  uint32_t network, netmask, file, nhosts, nparams, rid, net, has_net;
+};
+
+struct model_host {
+  uint64_t mac, namehash;
+  uint32_t name, hardware, address, file, nparams, rid, ip, flags;
+};
+
+struct model_param {
+  uint32_t name, value, file, pad;
+};
+
+#define MODEL_HAS_MAC  1
+#define MODEL_HAS_IP   2
+
+static uint32_t model_string (struct outbuf *ob, const char *str) {
+  uint32_t off = ob->len;
+  if ( str == NULL )
+    return MODEL_NONE;
+  ob_write(ob, str, strlen(str) + 1);
+  return off;
+}
+
+/* Params of one list, ranges numbered again from 0 as the parser
+ * would after a save.  Returns the next range id.
+ */
+static uint32_t model_params (struct dhcpd_conf *config, struct outbuf *rec, struct outbuf *str,
+			      struct dhcpd_params *pl, uint32_t *count) {
+  struct dhcpd_param *pa;
+  struct model_param mp;
+  char name[32];
+  uint32_t rid = 0;
+  for ( pa = pl->first; pa != NULL; pa = pa->next, (*count)++ ) {
+    memset(&mp, 0, sizeof(struct model_param));
+    if ( param_is_range(pa) ) {
+      snprintf(name, sizeof(name), "range%u", rid++);
+      mp.name = model_string(str, name);
+    } else {
+      mp.name = model_string(str, pa->name);
+    }
+    mp.value = model_string(str, pa->value);
+    mp.file = file_slot(config, pa->file);
+    ob_write(rec, (const char *) &mp, sizeof(struct model_param));
+  }
+  return rid;
+}
+
+/* Write the cache of config, loaded from or saved to filename.  Files
+ * are described by what was loaded or written, kept in their entries.
+ */
+static int model_cache_write (struct dhcpd_conf *config, const char *filename) {
+  struct outbuf rec[5], str;
+  struct model_head mh;
+  struct model_file mf;
+  struct model_include mi;
+  struct model_subnet ms;
+  struct model_host mo;
+  struct dhcpd_subnet *sn, *isn;
+  struct dhcpd_host *ho;
+  struct conf_include *inc;
+  struct conf_file *cf;
+  struct iovec iov[7];
+  char *dir, *path, *tmpname;
+  uint32_t i, nparams = 0, count;
+  int fdes, rc = EXIT_FAILURE;
+  if ( config->nfiles == 0 )
+    return EXIT_FAILURE;
+  memset(rec, 0, sizeof(rec));
+  memset(&str, 0, sizeof(struct outbuf));
+  memset(&mh, 0, sizeof(struct model_head));
+  for ( i = 0; i < (uint32_t) config->nfiles; i++ ) {
+    cf = config->files[i];
+    memset(&mf, 0, sizeof(struct model_file));
+    mf.path = model_string(&str, ( i == 0 ) ? filename : cf->path);
+    mf.scope = model_string(&str, cf->scope);
+    mf.crc = cf->crc;
+    mf.size = cf->size;
+    mf.mtime = cf->mtime.tv_sec;
+    mf.mtime_nsec = cf->mtime.tv_nsec;
+    ob_write(&rec[0], (const char *) &mf, sizeof(struct model_file));
+  }
+  for ( inc = config->includes; inc != NULL; inc = inc->next, mh.nincludes++ ) {
+    memset(&mi, 0, sizeof(struct model_include));
+    mi.name = model_string(&str, inc->name);
+    mi.parent = file_slot(config, inc->parent);
+    mi.scope = MODEL_NONE;
+    for ( i = 0, isn = config->subnets; inc->scope != NULL && isn != NULL; isn = isn->next, i++ )
+      if ( isn == inc->scope )
+	mi.scope = i;
+    ob_write(&rec[1], (const char *) &mi, sizeof(struct model_include));
+  }
+  mh.globals_rid = model_params(config, &rec[4], &str, &config->globals, &nparams);
+  mh.nglobals = nparams;
+  for ( sn = config->subnets; sn != NULL; sn = sn->next, mh.nsubnets++ ) {
+    memset(&ms, 0, sizeof(struct model_subnet));
+    ms.network = model_string(&str, sn->network);
+    ms.netmask = model_string(&str, sn->netmask);
+    ms.file = file_slot(config, sn->file);
+    ms.net = sn->net;
+    ms.has_net = sn->has_net;
+    count = 0;
+    ms.rid = model_params(config, &rec[4], &str, &sn->params, &count);
+    ms.nparams = count;
+    nparams += count;
+    for ( ho = sn->hosts; ho != NULL; ho = ho->next, ms.nhosts++, mh.nhosts++ ) {
+      memset(&mo, 0, sizeof(struct model_host));
+      mo.name = model_string(&str, ho->name);
+      mo.hardware = model_string(&str, ho->hardware);
+      mo.address = model_string(&str, ho->address);
+      mo.file = file_slot(config, ho->file);
+      mo.mac = ho->mac;
+      mo.ip = ho->ip;
+      mo.namehash = ho->namehash;
+      mo.flags = ( ho->has_mac ? MODEL_HAS_MAC : 0 ) | ( ho->has_ip ? MODEL_HAS_IP : 0 );
+      count = 0;
+      mo.rid = model_params(config, &rec[4], &str, &ho->params, &count);
+      mo.nparams = count;
+      nparams += count;
+      ob_write(&rec[3], (const char *) &mo, sizeof(struct model_host));
+    }
+    ob_write(&rec[2], (const char *) &ms, sizeof(struct model_subnet));
+  }
+  memcpy(mh.magic, MODEL_MAGIC, 8);
+  mh.version = MODEL_VERSION;
+  mh.nfiles = config->nfiles;
+  mh.nparams = nparams;
+  mh.strings = str.len;
+  mh.length = sizeof(struct model_head) + str.len;
+  iov[0].iov_base = &mh;
+  iov[0].iov_len = sizeof(struct model_head);
+  for ( i = 0; i < 5; i++ ) {
+    iov[i + 1].iov_base = rec[i].data;
+    iov[i + 1].iov_len = rec[i].len;
+    mh.length += rec[i].len;
+  }
+  iov[6].iov_base = str.data;
+  iov[6].iov_len = str.len;
+  mh.crc = crc32(0L, Z_NULL, 0);
+  for ( i = 1; i < 7; i++ )
+    if ( iov[i].iov_len > 0 )
+      mh.crc = crc32(mh.crc, iov[i].iov_base, iov[i].iov_len);
+  asprintf(&dir, "%s" STORE_SUFFIX, filename);
+  asprintf(&path, "%s/" MODEL_NAME, dir);
+  asprintf(&tmpname, "%s.XXXXXX", path);
+  if ( ( mkdir(dir, 0755) == 0 || errno == EEXIST ) && ( fdes = mkstemp(tmpname) ) != -1 ) {
+    if ( write_iov(fdes, iov, 7) == 0 && close(fdes) == 0 && rename(tmpname, path) == 0 )
+      rc = EXIT_SUCCESS;
+    else
+      unlink(tmpname);
+  }
+  for ( i = 0; i < 5; i++ )
+    ob_free(&rec[i]);
+  ob_free(&str);
+  free(tmpname);
+  free(path);
+  free(dir);
+  return rc;
+}
+
+/* Whether every regular file matching the includes was in the cache. */
+static int model_includes_same (struct model_include *mi, uint32_t nincludes, const char *strings,
+				struct stat *fsb, uint32_t nfiles) {
+  glob_t gl;
+  struct stat sb;
+  char *pattern;
+  uint32_t i, f;
+  size_t m;
+  int same = 1;
+  for ( i = 0; i < nincludes && same; i++ ) {
+    if ( strings[mi[i].name] == '/' )
+      pattern = savestring(strings + mi[i].name);
+    else
+      asprintf(&pattern, DEFPATH "%s", strings + mi[i].name);
+    if ( glob(pattern, 0, NULL, &gl) == 0 ) {
+      for ( m = 0; m < gl.gl_pathc && same; m++ ) {
+	if ( stat(gl.gl_pathv[m], &sb) == -1 || ! S_ISREG(sb.st_mode) )
+	  continue;
+	for ( f = 0; f < nfiles; f++ )
+	  if ( fsb[f].st_dev == sb.st_dev && fsb[f].st_ino == sb.st_ino )
+	    break;
+	same = f < nfiles;
+      }
+      globfree(&gl);
+    }
+    free(pattern);
+  }
+  return same;
+}
+
+/* Rebuild the configuration of filename from its cache, crc is the
+ * one of its content.  Returns NULL when the cache can't be used.
+ */
+static struct dhcpd_conf *model_cache_load (const char *filename, size_t size, uint32_t crc) {
+  struct model_head *mh;
+  struct model_file *mf;
+  struct model_include *mi;
+  struct model_subnet *ms;
+  struct model_host *mo;
+  struct model_param *mp;
+  struct dhcpd_conf *config = NULL;
+  struct dhcpd_subnet *sn = NULL;
+  struct dhcpd_host *ho = NULL;
+  struct dhcpd_param *pa = NULL;
+  struct dhcpd_params *pl;
+  struct conf_include *inc;
+  struct conf_file *cf;
+  struct stat sb, *fsb = NULL;
+  char *path, *map = MAP_FAILED, *strings, *buf;
+  const char *scope;
+  uint64_t need, nh = 0, np;
+  uint32_t i, j, k, h = 0, p = 0;
+  size_t len, flen;
+  int fdes;
+  asprintf(&path, "%s" STORE_SUFFIX "/" MODEL_NAME, filename);
+  fdes = open(path, O_RDONLY);
+  free(path);
+  if ( fdes == -1 )
+    return NULL;
+  if ( fstat(fdes, &sb) == 0 && sb.st_size >= (off_t) sizeof(struct model_head) )
+    map = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fdes, 0);
+  close(fdes);
+  if ( map == MAP_FAILED )
+    return NULL;
+  len = sb.st_size;
+  /* the head, sizes and checksum */
+  mh = (struct model_head *) map;
+  need = sizeof(struct model_head) + (uint64_t) mh->nfiles * sizeof(struct model_file) +
+    (uint64_t) mh->nincludes * sizeof(struct model_include) +
+    (uint64_t) mh->nsubnets * sizeof(struct model_subnet) +
+    (uint64_t) mh->nhosts * sizeof(struct model_host) +
+    (uint64_t) mh->nparams * sizeof(struct model_param) + mh->strings;
+  if ( memcmp(mh->magic, MODEL_MAGIC, 8) != 0 || mh->version != MODEL_VERSION ||
+       mh->length != len || need != len || mh->nfiles == 0 || mh->strings == 0 ||
+       mh->nglobals > mh->nparams ||
+       crc32(0L, (const Bytef *) map + sizeof(struct model_head), len - sizeof(struct model_head)) != mh->crc )
+    goto unusable;
+  mf = (struct model_file *) ( map + sizeof(struct model_head) );
+  mi = (struct model_include *) ( mf + mh->nfiles );
+  ms = (struct model_subnet *) ( mi + mh->nincludes );
+  mo = (struct model_host *) ( ms + mh->nsubnets );
+  mp = (struct model_param *) ( mo + mh->nhosts );
+  strings = map + len - mh->strings;
+  if ( strings[mh->strings - 1] != 0x00 )
+    goto unusable;
+#define MODEL_STR(off)  ( (off) < mh->strings )
+#define MODEL_OPT(off)  ( (off) == MODEL_NONE || (off) < mh->strings )
+  /* every index and string in range */
+  for ( i = 0; i < mh->nfiles; i++ )
+    if ( ! MODEL_STR(mf[i].path) || ! MODEL_OPT(mf[i].scope) )
+      goto unusable;
+  for ( i = 0; i < mh->nincludes; i++ )
+    if ( ! MODEL_STR(mi[i].name) || mi[i].parent >= mh->nfiles ||
+	 ( mi[i].scope != MODEL_NONE && mi[i].scope >= mh->nsubnets ) )
+      goto unusable;
+  for ( i = 0, np = mh->nglobals; i < mh->nsubnets; i++ ) {
+    if ( ! MODEL_STR(ms[i].network) || ! MODEL_OPT(ms[i].netmask) || ms[i].file >= mh->nfiles )
+      goto unusable;
+    nh += ms[i].nhosts;
+    np += ms[i].nparams;
+  }
+  if ( nh != mh->nhosts )
+    goto unusable;
+  for ( i = 0; i < mh->nhosts; i++ ) {
+    if ( ! MODEL_STR(mo[i].name) || ! MODEL_OPT(mo[i].hardware) || ! MODEL_OPT(mo[i].address) ||
+	 mo[i].file >= mh->nfiles )
+      goto unusable;
+    np += mo[i].nparams;
+  }
+  if ( np != mh->nparams )
+    goto unusable;
+  for ( i = 0; i < mh->nparams; i++ )
+    if ( ! MODEL_STR(mp[i].name) || ! MODEL_STR(mp[i].value) || mp[i].file >= mh->nfiles )
+      goto unusable;
+  /* the files are still the ones cached */
+  fsb = xmalloc(sizeof(struct stat) * mh->nfiles);
+  for ( i = 0; i < mh->nfiles; i++ ) {
+    if ( stat(( i == 0 ) ? filename : strings + mf[i].path, &fsb[i]) == -1 ||
+	 fsb[i].st_size != mf[i].size || fsb[i].st_mtim.tv_sec != mf[i].mtime ||
+	 fsb[i].st_mtim.tv_nsec != mf[i].mtime_nsec )
+      goto unusable;
+    if ( i == 0 ) {
+      if ( size != mf[i].size || crc != mf[i].crc )
+	goto unusable;
+    } else {
+      if ( ( buf = load_file(strings + mf[i].path, &flen) ) == NULL )
+	goto unusable;
+      k = crc32(0L, (const Bytef *) buf, flen) == mf[i].crc;
+      free(buf);
+      if ( ! k )
+	goto unusable;
+    }
+  }
+  if ( ! model_includes_same(mi, mh->nincludes, strings, fsb, mh->nfiles) )
+    goto unusable;
+  /* rebuild the model, strings stay in the mapping */
+  config = new_conf();
+  config->map = map;
+  config->maplen = len;
+  for ( i = 0; i < mh->nfiles; i++ ) {
+    cf = file_entry(( i == 0 ) ? filename : strings + mf[i].path);
+    scope = ( mf[i].scope != MODEL_NONE ) ? strings + mf[i].scope : NULL;
+    if ( ( cf->scope == NULL ) != ( scope == NULL ) || ( scope != NULL && strcmp(cf->scope, scope) != 0 ) ) {
+      if ( cf->part != NULL )
+	destroy_conf(cf->part);
+      cf->part = NULL;
+      free(cf->scope);
+      cf->scope = ( scope != NULL ) ? savestring(scope) : NULL;
+    }
+    cf->dev = fsb[i].st_dev;
+    cf->ino = fsb[i].st_ino;
+    cf->size = fsb[i].st_size;
+    cf->mtime = fsb[i].st_mtim;
+    cf->crc = mf[i].crc;
+    file_add(config, cf);
+  }
+  if ( mh->nparams > 0 )
+    pa = arena_alloc(&config->arena, sizeof(struct dhcpd_param) * mh->nparams);
+  if ( mh->nsubnets > 0 )
+    sn = arena_alloc(&config->arena, sizeof(struct dhcpd_subnet) * mh->nsubnets);
+  if ( mh->nhosts > 0 )
+    ho = arena_alloc(&config->arena, sizeof(struct dhcpd_host) * mh->nhosts);
+  for ( i = 0; i < mh->nparams; i++ ) {
+    pa[i].name = strings + mp[i].name;
+    pa[i].value = strings + mp[i].value;
+    pa[i].file = config->files[mp[i].file];
+    pa[i].next = NULL;
+  }
+  /* params of a list are in a row, so only its end is linked */
+#define MODEL_PARAMS(list, n, id) do {				\
+    (list)->count = (n);					\
+    (list)->rid = (id);						\
+    (list)->first = ( (n) > 0 ) ? &pa[p] : NULL;		\
+    (list)->last = ( (n) > 0 ) ? &pa[p + (n) - 1] : NULL;	\
+    for ( k = 1; k < (n); k++ )					\
+      pa[p + k - 1].next = &pa[p + k];				\
+    p += (n);							\
+  } while ( 0 )
+  pl = &config->globals;
+  MODEL_PARAMS(pl, mh->nglobals, mh->globals_rid);
+  config->sorted.subnet = xmalloc(sizeof(struct dhcpd_subnet *) * ( mh->nsubnets + 1 ));
+  config->sorted.size = mh->nsubnets + 1;
+  index_reserve(&config->by_name, mh->nhosts);
+  index_reserve(&config->by_mac, mh->nhosts);
+  index_reserve(&config->by_ip, mh->nhosts);
+  for ( i = 0; i < mh->nsubnets; i++ ) {
+    memset(&sn[i], 0, sizeof(struct dhcpd_subnet));
+    sn[i].network = strings + ms[i].network;
+    sn[i].netmask = ( ms[i].netmask != MODEL_NONE ) ? strings + ms[i].netmask : NULL;
+    sn[i].net = ms[i].net;
+    sn[i].has_net = ms[i].has_net;
+    sn[i].file = config->files[ms[i].file];
+    pl = &sn[i].params;
+    MODEL_PARAMS(pl, ms[i].nparams, ms[i].rid);
+    for ( j = 0; j < ms[i].nhosts; j++, h++ ) {
+      memset(&ho[h], 0, sizeof(struct dhcpd_host));
+      ho[h].name = strings + mo[h].name;
+      ho[h].hardware = ( mo[h].hardware != MODEL_NONE ) ? strings + mo[h].hardware : NULL;
+      ho[h].address = ( mo[h].address != MODEL_NONE ) ? strings + mo[h].address : NULL;
+      ho[h].mac = mo[h].mac;
+      ho[h].ip = mo[h].ip;
+      ho[h].namehash = mo[h].namehash;
+      ho[h].seq = h + 1;
+      ho[h].has_mac = ( mo[h].flags & MODEL_HAS_MAC ) != 0;
+      ho[h].has_ip = ( mo[h].flags & MODEL_HAS_IP ) != 0;
+      ho[h].file = config->files[mo[h].file];
+      ho[h].subnet = &sn[i];
+      pl = &ho[h].params;
+      MODEL_PARAMS(pl, mo[h].nparams, mo[h].rid);
+      if ( sn[i].hosts_last != NULL )
+	sn[i].hosts_last->next = &ho[h];
+      else
+	sn[i].hosts = &ho[h];
+      sn[i].hosts_last = &ho[h];
+      sn[i].nhosts++;
+      index_add(&config->by_name, &ho[h], KEY_NAME);
+      if ( ho[h].has_mac )
+	index_add(&config->by_mac, &ho[h], KEY_MAC);
+      if ( ho[h].has_ip )
+	index_add(&config->by_ip, &ho[h], KEY_IP);
+    }
+    if ( config->subnets_last != NULL )
+      config->subnets_last->next = &sn[i];
+    else
+      config->subnets = &sn[i];
+    config->subnets_last = &sn[i];
+    config->sorted.subnet[i] = &sn[i];
+  }
+#undef MODEL_PARAMS
+#undef MODEL_STR
+#undef MODEL_OPT
+  config->nsubnets = mh->nsubnets;
+  config->nhosts = mh->nhosts;
+  config->host_seq = mh->nhosts;
+  config->sorted.count = mh->nsubnets;
+  qsort(config->sorted.subnet, config->sorted.count, sizeof(struct dhcpd_subnet *), subnet_ptr_cmp);
+  for ( i = 0; i < mh->nincludes; i++ ) {
+    inc = arena_alloc(&config->arena, sizeof(struct conf_include));
+    inc->name = strings + mi[i].name;
+    inc->scope = ( mi[i].scope != MODEL_NONE ) ? &sn[mi[i].scope] : NULL;
+    inc->parent = config->files[mi[i].parent];
+    inc->next = NULL;
+    if ( config->includes_last != NULL )
+      config->includes_last->next = inc;
+    else
+      config->includes = inc;
+    config->includes_last = inc;
+  }
+  free(fsb);
+  return config;
+ unusable:
+  free(fsb);
+  munmap(map, len);
+  return NULL;
+}
+
+/* Obtain configuration from file and the files it includes and put it
+ * into the configuration model.
+ */
+struct dhcpd_conf *get_dhcpd_config (const char *filename) {
+  size_t size;
+  char *buf;
+  int stored;
+  uint32_t crc;
+  struct dhcpd_conf *config;
+  struct conf_file *cf;
+  struct stat sb;
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  memset(&last_load, 0, sizeof(struct load_times));
+  if ( ( buf = load_config_file(filename, &size, &stored) ) == NULL ) {
     printf ("open %s, failed.\n", filename);
-    free(gs);
     endwin();
     exit(EXIT_FAILURE);
   }
-  asprintf(&prefix_subnet, "%s", "");
-  asprintf(&prefix_host, "%s", "");
-  asprintf(&prefix_plus_key, "%s", "");
-  if ( ( fstream = fdopen(fdes, "r") ) != NULL ) {
-#ifdef _DEBUG
-    endwin();
-#endif
-    rid = 0;
-    while ( fgets(gs, BUFSIZ - 1, fstream) != NULL ) {
-      gs[BUFSIZ - 1] = 0x00; /* NULL */
-      /* pre processing special chars here */
-      gs = as_rex (gs, "#.*$", "", "");
-      gs = as_rex (gs, "[;{}]", "", "g");
-      gs = as_rex (gs, "[ \t\r\n]+", " ", "g");
-      gs = as_rex (gs, "(^ | $)", "", "g");
-      /* pre processing keywords here */
-      gs = as_rex (gs, "^hardware ethernet", "hardware+ethernet", "");
-      gs = as_rex (gs, "^option ", "option+", "");
-      gs = as_rex (gs, "^subnet ", "subnet+", "");
-      gs = as_rex (gs, "netmask ", "netmask+", "");
-      gs = as_rex (gs, "^authoritative$", "authoritative ", "");
-      /* last step: making key=value */
-      gs = as_rex (gs, " ", "=", "");
-      /* upload to memory just reserved keywords */
-      if ( m_rex (gs,
-		  "^(ddns-update-style|default-lease-time|max-lease-time|"
-		  "shared-network|authoritative|log-facility|subnet|host|"
-		  "hardware|fixed-address|option|range)", "")
-	   ) {
-	/* upload to memory just lines with equals mark */
-	if ( m_rex (gs, "=", "") ) {
-	  strarray = split ("=", "", gs, &ele_strarray);
-	  /* hasn't it value? make a null value */
-	  if ( ele_strarray < 2 ) {
-	    strarray[1] = xmalloc(1);
-	    strarray[1][0] = 0x00; /* NULL */
-	    ele_strarray++;
-	  }
-	  free(prefix_plus_key);
-	  if ( m_rex (strarray[0], "^(subnet|option|range)", "") ) {
-	    if ( m_rex (strarray[0], "^subnet", "") ) {
-	      rid = 0;
-	      free(prefix_subnet);
-	      asprintf(&prefix_subnet, "%s", "");
-	    }
-	    free(prefix_host);
-	    asprintf(&prefix_host, "%s", "");
-	  }
-	  if ( m_rex (strarray[0], "^range", "") ) {
-	    asprintf(&prefix_plus_key, "%s%s%s%i",
-		     prefix_subnet, prefix_host, strarray[0], rid);
-	    rid++;
-	  } else {
-	    if ( m_rex (strarray[0], "^option", "") && ( strlen(prefix_subnet) == 0 ) ) {
-	      asprintf(&prefix_plus_key, "%s", "");
-	      free_double_pointer(strarray, ele_strarray);
-	      goto skipoption;
-	    } else {
-	      asprintf(&prefix_plus_key, "%s%s%s",
-		       prefix_subnet, prefix_host, strarray[0]);
-	    }
-	  }
-	  if ( ! m_rex (strarray[0], "^host", "") ) {
-	    put_aa(config, prefix_plus_key, strarray[1]);
-#if defined( _DEBUG ) && !defined( _INFO )
-	    printf("%s=%s\n", prefix_plus_key, strarray[1]);
-#endif
-	  }
-	  if ( m_rex (strarray[0], "^subnet", "") ) {
-	    free(prefix_subnet);
-	    asprintf(&prefix_subnet, "%s/", strarray[0]);
-	    free(prefix_host);
-	    asprintf(&prefix_host, "%s", "");
-	  }
-	  if ( m_rex (strarray[0], "^host", "") ) {
-	    free(prefix_host);
-	    asprintf(&prefix_host, "%s/", strarray[1]);
-	  }
-	  free_double_pointer(strarray, ele_strarray);
-	}
+  crc = crc32(0L, (const Bytef *) buf, size);
+  last_load.read = lap(&t);
+  /* backups from the store are not cached */
+  if ( ! stored && ( config = model_cache_load(filename, size, crc) ) != NULL ) {
+    free(buf);
+    last_load.merge = lap(&t);
+    last_load.files = config->nfiles;
+    last_load.model = 1;
+    STAT_TIME(T_LOAD, last_load.read + last_load.merge);
+    return(config);
+  }
+  config = new_conf();
+  cf = file_entry(filename);
+  if ( stat(filename, &sb) == 0 ) {
+    cf->dev = sb.st_dev;
+    cf->ino = sb.st_ino;
+    cf->size = sb.st_size;
+    cf->mtime = sb.st_mtim;
+  }
+  cf->crc = crc;
+  file_add(config, cf);
+#ifdef _DEBUG
+  endwin();
+#endif
+  config->file = cf;
+  parse_buffer(config, buf, size, NULL, &t);
+  config->file = NULL;
+  free(buf);
+  load_includes(config, cf, 1, &t);
+  last_load.files = config->nfiles;
+  if ( ! stored && strcmp(filename, model_config) == 0 )
+    model_cache_write(config, filename);
+  STAT_TIME(T_LOAD, last_load.read + last_load.parse + last_load.merge);
+#ifdef _DEBUG
+# ifndef _INFO
+  printf("\nPress any key..."); getchar();
+# endif
+  (void) initscr();
+#endif
+  return(config);
+}
+
+/* Menu arrays grow in the scratch arena, doubling the room each time
+ * the count hits a power of two.
+ */
+static char **menu_push (char **menu, int *menusz, char *item) {
+  char **grown;
+  if ( *menusz >= 8 && ( *menusz & ( *menusz - 1 ) ) == 0 ) {
+    grown = arena_alloc(&scratch, sizeof(char *) * 2 * (*menusz));
+    memcpy(grown, menu, sizeof(char *) * (*menusz));
+    menu = grown;
+  }
+  menu[(*menusz)++] = item;
+  return menu;
+}
+
+char **manual_fast_menu (int *menusz, ...) {
+  va_list strings;
+  char *vas, **menu;
+  STAT_START(t0);
+  va_start (strings, menusz);
+  *menusz = 0;
+  menu = arena_alloc(&scratch, sizeof(char *) * 8);
+  while ( ( vas = va_arg(strings, char *) ) != NULL )
+    menu = menu_push(menu, menusz, arena_strdup(&scratch, vas));
+  va_end (strings);
+  STAT_STOP(T_MENU, t0);
+  return menu;
+}
+
+/* Copy fnin to fnout inside the kernel: a reflink where the filesystem
+ * can share extents, copy_file_range otherwise, and a read/write loop
+ * for whatever is left when neither works (other filesystem, old
+ * kernel).
+ */
+int filecopy (const char *fnin, const char *fnout) {
+  int inputFd, outputFd, openFlags, rc = EXIT_FAILURE;
+  mode_t filePerms;
+  ssize_t numRead, numWritten, wr;
+  off_t done = 0;
+  struct stat sb;
+  char buf[65536];
+
+  /* Open input and output files */
+  if ( ( inputFd = open(fnin, O_RDONLY) ) == -1 )
+    return EXIT_FAILURE;
+  openFlags = O_CREAT | O_WRONLY | O_TRUNC;
+  filePerms = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH; /* rw-r--r-- */
+  if ( fstat(inputFd, &sb) == -1 || ( outputFd = open(fnout, openFlags, filePerms) ) == -1 ) {
+    close(inputFd);
+    return EXIT_FAILURE;
+  }
+#ifdef FICLONE
+  if ( ioctl(outputFd, FICLONE, inputFd) == 0 ) {
+    rc = EXIT_SUCCESS;
+    goto done;
+  }
+#endif
+  while ( done < sb.st_size ) {
+    if ( ( wr = copy_file_range(inputFd, NULL, outputFd, NULL, sb.st_size - done, 0) ) == -1 && errno == EINTR )
+      continue;
+    if ( wr <= 0 )
+      break;
+    done += wr;
+    STAT_ADD(C_WRITTEN, wr);
+  }
+  /* both offsets moved with the copy, go on from there */
+  while ( ( numRead = read(inputFd, buf, sizeof(buf)) ) != 0 ) {
+    if ( numRead == -1 ) {
+      if ( errno == EINTR )
+	continue;
+      goto done;
+    }
+    for ( numWritten = 0; numWritten < numRead; numWritten += wr ) {
+      if ( ( wr = write(outputFd, buf + numWritten, numRead - numWritten) ) == -1 ) {
+	if ( errno != EINTR )
+	  goto done;
+	wr = 0;
+      }
+      STAT_ADD(C_WRITTEN, wr);
+    }
+  }
+  rc = EXIT_SUCCESS;
+ done:
+  if ( close(inputFd) == -1 )
+    rc = EXIT_FAILURE;
+  if ( close(outputFd) == -1 )
+    rc = EXIT_FAILURE;
+  return rc;
+}
+
+/* One page of the backup catalog, newest first, with Newer and Older
+ * entries to move between pages.  Tags are relative to DEFPATH.
+ */
+char **catalog_fast_menu (int *menusz, long page) {
+  struct catalog_entry ce[CATALOG_PAGE];
+  struct tm *tm;
+  time_t t;
+  char **menu, date[32];
+  long count, total, i;
+  STAT_START(t0);
+  count = catalog_read(DEFCONFIG, page, ce, &total);
+  *menusz = 0;
+  menu = arena_alloc(&scratch, sizeof(char *) * 2 * ( count + 2 ));
+  if ( page > 0 ) {
+    menu[(*menusz)++] = arena_strdup(&scratch, "Newer");
+    menu[(*menusz)++] = arena_strdup(&scratch, "Newer backups");
+  }
+  for ( i = 0; i < count; i++ ) {
+    t = ce[i].time;
+    tm = localtime(&t);
+    strftime(date, sizeof(date), "%Y/%m/%d %H:%M:%S", tm);
+    menu[(*menusz)++] = arena_strdup(&scratch, ce[i].path);
+    menu[(*menusz)++] = arena_printf(&scratch, "%s %5u subnets %6u hosts %6luK", date,
+				     ce[i].nsubnets, ce[i].nhosts,
+				     (unsigned long) ( ( ce[i].size + 1023 ) / 1024 ));
+  }
+  if ( ( page + 1 ) * CATALOG_PAGE < total ) {
+    menu[(*menusz)++] = arena_strdup(&scratch, "Older");
+    menu[(*menusz)++] = arena_printf(&scratch, "Older backups, %li more", total - ( page + 1 ) * CATALOG_PAGE);
+  }
+  STAT_STOP(T_MENU, t0);
+  return menu;
+}
+
+/* Every subnet in address order, then the entry to create one. */
+char **subnet_fast_menu (int *menusz, struct dhcpd_conf *config) {
+  struct dhcpd_subnet *sn;
+  char **menu;
+  long i;
+  STAT_START(t0);
+  *menusz = 0;
+  menu = arena_alloc(&scratch, sizeof(char *) * (2 * config->nsubnets + 3));
+  for ( i = 0; i < config->sorted.count; i++ ) {
+    sn = config->sorted.subnet[i];
+    menu[(*menusz)++] = arena_printf(&scratch, "subnet+%s", sn->network);
+    menu[(*menusz)++] = arena_printf(&scratch, "%s/%s", sn->network, sn->netmask);
+  }
+  menu[(*menusz)++] = arena_strdup(&scratch, "Create subnet");
+  menu[(*menusz)++] = arena_strdup(&scratch, "Create a new subnetwork");
+  STAT_STOP(T_MENU, t0);
+  return menu;
+}
+
+/* Hosts of a subnet as they are in the file, with MAC and address. */
+char **host_fast_menu (int *menusz, struct dhcpd_subnet *sn) {
+  struct dhcpd_host *ho;
+  char **menu;
+  STAT_START(t0);
+  *menusz = 0;
+  menu = arena_alloc(&scratch, sizeof(char *) * (2 * sn->nhosts + 1));
+  for ( ho = sn->hosts; ho != NULL; ho = ho->next ) {
+    menu[(*menusz)++] = arena_strdup(&scratch, ho->name);
+    menu[(*menusz)++] = arena_printf(&scratch, "%s %s", ( ho->hardware != NULL ) ? ho->hardware : "",
+				     ( ho->address != NULL ) ? ho->address : "");
+  }
+  STAT_STOP(T_MENU, t0);
+  return menu;
+}
+
+/* Write a statement as "name value;", '+' joined keywords are split
+ * back and ranges lose its number.
+ */
+static void ob_param (struct outbuf *ob, const char *indent, struct dhcpd_param *pa) {
+  const char *c;
+  ob_puts(ob, indent);
+  if ( param_is_range(pa) ) {
+    ob_puts(ob, "range");
+  } else {
+    for ( c = pa->name; *c; c++ )
+      ob_write(ob, ( *c == '+' ) ? " " : c, 1);
+  }
+  if ( pa->value[0] != 0x00 ) {
+    ob_puts(ob, " ");
+    ob_puts(ob, pa->value);
+  }
+  ob_puts(ob, ";\n");
+}
+
+/* Parallel save.  Subnet blocks do not depend on each other, runs of
+ * them with about the same number of hosts are rendered by several
+ * threads in buffers of their own, one for each file, written in order
+ * by one writev.
+ */
+#define RENDER_CHUNK  512   /* subnets and hosts at least in each chunk */
+
+struct render_job {
+  pthread_mutex_t lock;
+  int next, count;
+  struct dhcpd_subnet **first;   /* chunk i goes from first[i] to first[i + 1] */
+  long *weight;
+  struct outbuf *part;           /* nfiles buffers for each chunk */
+  struct dhcpd_conf *config;
+  int nfiles;
+  int *shared;                   /* files with a shared-network block */
+  struct dhcpd_subnet **scope;   /* subnet each file is included in */
+};
+
+static void ob_host (struct outbuf *ob, struct dhcpd_host *ho, const char *tabs, const char *indent) {
+  struct dhcpd_param *pa;
+  ob_printf(ob, "%s  host %s {\n", tabs, ho->name);
+  if ( ho->hardware != NULL )
+    ob_printf(ob, "%shardware ethernet %s;\n", indent, ho->hardware);
+  if ( ho->address != NULL )
+    ob_printf(ob, "%sfixed-address %s;\n", indent, ho->address);
+  for ( pa = ho->params.first; pa != NULL; pa = pa->next )
+    ob_param(ob, indent, pa);
+  ob_printf(ob, "%s  }\n", tabs);
+}
+
+/* Buffer of file f for things of subnet sn.  A file which is not the
+ * one of the subnet nor included in it opens the subnet again, open[]
+ * keeps those files until the block is closed.
+ */
+static struct outbuf *ob_open (struct render_job *job, struct outbuf *out, int f,
+			       struct dhcpd_subnet *sn, int *open, int *nopen) {
+  int i;
+  if ( f == file_slot(job->config, sn->file) || job->scope[f] == sn )
+    return &out[f];
+  for ( i = 0; i < *nopen; i++ )
+    if ( open[i] == f )
+      return &out[f];
+  open[(*nopen)++] = f;
+  ob_printf(&out[f], "%ssubnet %s netmask %s {\n", job->shared[f] ? "  " : "", sn->network, sn->netmask);
+  return &out[f];
+}
+
+/* One subnet block with its hosts, includes, ranges and options, each
+ * one in the buffer of its file.
+ */
+static void ob_subnet (struct render_job *job, struct outbuf *out, struct dhcpd_subnet *sn, int *open) {
+  struct dhcpd_host *ho;
+  struct dhcpd_param *pa;
+  struct conf_include *inc;
+  int f = file_slot(job->config, sn->file), h, i, nopen = 0;
+  const char *tabs = job->shared[f] ? "  " : "", *indent = job->shared[f] ? "      " : "    ";
+  ob_printf(&out[f], "%ssubnet %s netmask %s {\n", tabs, sn->network, sn->netmask);
+  for ( ho = sn->hosts; ho != NULL; ho = ho->next ) {
+    h = file_slot(job->config, ho->file);
+    ob_host(ob_open(job, out, h, sn, open, &nopen), ho, job->shared[h] ? "  " : "",
+	    job->shared[h] ? "      " : "    ");
+  }
+  for ( inc = job->config->includes; inc != NULL; inc = inc->next ) {
+    if ( inc->scope == sn ) {
+      h = file_slot(job->config, inc->parent);
+      ob_printf(ob_open(job, out, h, sn, open, &nopen), "%s  include \"%s\";\n",
+		job->shared[h] ? "  " : "", inc->name);
+    }
+  }
+  /* ranges and options go after hosts */
+  for ( pa = sn->params.first; pa != NULL; pa = pa->next )
+    ob_param(&out[f], indent + 2, pa);
+  ob_printf(&out[f], "%s}\n", tabs);
+  for ( i = 0; i < nopen; i++ )
+    ob_printf(&out[open[i]], "%s}\n", job->shared[open[i]] ? "  " : "");
+}
+
+static void *render_worker (void *arg) {
+  struct render_job *job = arg;
+  struct dhcpd_subnet *sn;
+  int i, *open = xmalloc(sizeof(int) * job->nfiles);
+  for ( ;; ) {
+    pthread_mutex_lock(&job->lock);
+    i = job->next++;
+    pthread_mutex_unlock(&job->lock);
+    if ( i >= job->count ) {
+      free(open);
+      return NULL;
+    }
+    /* most of a chunk goes to the file of its first subnet */
+    ob_init(&job->part[i * job->nfiles + file_slot(job->config, job->first[i]->file)], 128 * job->weight[i]);
+    for ( sn = job->first[i]; sn != job->first[i + 1]; sn = sn->next )
+      ob_subnet(job, job->part + i * job->nfiles, sn, open);
+  }
+}
+
+/* Seconds spent by each step of the last save. */
+struct save_times {
+  double backup, render, write, sync, rename;
+  int threads;
+} last_save;
+
+/* Back up filename, then write iov to a temporary file next to it,
+ * flush it to disk and rename it over filename, so dhcpd sees either
+ * the old or the new file, never a truncated one.
+ */
+static int write_config_file (const char *filename, const char *suffix, struct iovec *iov,
+			      int iovcnt, struct timespec *t) {
+  int fdes, dirfd, err;
+  char *filename_suffix, *target, *tmpname, *slash;
+  struct stat sb;
+  /* a full copy only when the store can't be used */
+  if ( backup_store(filename, suffix) != 0 ) {
+    asprintf(&filename_suffix, "%s%s", filename, suffix);
+    if ( filecopy (filename, filename_suffix) != 0 ) {
+      free(filename_suffix);
+      return EXIT_FAILURE;
+    }
+    free(filename_suffix);
+  }
+  last_save.backup += lap(t);
+  /* a symlinked dhcpd.conf is replaced where it points to */
+  if ( ( target = realpath(filename, NULL) ) == NULL )
+    target = savestring(filename);
+  asprintf(&tmpname, "%s.XXXXXX", target);
+  if ( ( fdes = mkstemp(tmpname) ) == -1 ) {
+#if defined( _DEBUG ) && !defined( _INFO )
+    printf ("open %s, failed.\n", tmpname);
+#endif
+    err = errno;
+    goto failed;
+  }
+  if ( stat(target, &sb) == 0 ) {
+    if ( fchown(fdes, sb.st_uid, sb.st_gid) == -1 ) {
+      /* not root, the file stays ours */
+    }
+    fchmod(fdes, sb.st_mode & 07777);
+  } else {
+    fchmod(fdes, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  }
+  if ( write_iov(fdes, iov, iovcnt) == -1 ) {
+    err = errno;
+    goto unlink;
+  }
+  last_save.write += lap(t);
+  if ( fsync(fdes) == -1 ) {
+    err = errno;
+    goto unlink;
+  }
+  if ( close(fdes) == -1 ) {
+    err = errno;
+    fdes = -1;
+    goto unlink;
+  }
+  fdes = -1;
+  last_save.sync += lap(t);
+  if ( rename(tmpname, target) == -1 ) {
+    err = errno;
+    goto unlink;
+  }
+  /* make the rename itself durable */
+  if ( ( slash = strrchr(target, '/') ) != NULL ) {
+    *slash = 0x00; /* NULL */
+    if ( ( dirfd = open(( *target ) ? target : "/", O_RDONLY | O_DIRECTORY) ) != -1 ) {
+      fsync(dirfd);
+      close(dirfd);
+    }
+  }
+  last_save.rename += lap(t);
+  free(tmpname);
+  free(target);
+  return EXIT_SUCCESS;
+ unlink:
+  if ( fdes != -1 )
+    close(fdes);
+  unlink(tmpname);
+ failed:
+  free(tmpname);
+  free(target);
+  errno = err;
+  return EXIT_FAILURE;
+}
+
+/* Whether filename holds already what iov would write. */
+static int file_same (const char *filename, struct iovec *iov, int iovcnt) {
+  size_t size, done = 0;
+  char *buf;
+  int i, same = 1;
+  if ( ( buf = load_file(filename, &size) ) == NULL )
+    return 0;
+  for ( i = 0; i < iovcnt && same; i++ ) {
+    same = done + iov[i].iov_len <= size && memcmp(buf + done, iov[i].iov_base, iov[i].iov_len) == 0;
+    done += iov[i].iov_len;
+  }
+  free(buf);
+  return same && done == size;
+}
+
+/* Take note of what a save left in a file for the model cache, the
+ * copy of an included file is stale once the file is rewritten.
+ */
+static void file_saved (struct conf_file *cf, const char *path, uint32_t crc, int changed) {
+  struct stat sb;
+  if ( changed && cf->part != NULL ) {
+    destroy_conf(cf->part);
+    cf->part = NULL;
+  }
+  if ( stat(path, &sb) == 0 ) {
+    cf->dev = sb.st_dev;
+    cf->ino = sb.st_ino;
+    cf->size = sb.st_size;
+    cf->mtime = sb.st_mtim;
+  }
+  cf->crc = crc;
+}
+
+/* Save the configuration, dhcpd.conf to filename and every statement
+ * of an included file back to that file.  Included files are only
+ * written when they change, before dhcpd.conf.
+ */
+int save_dhcpd_config (const char *filename, struct dhcpd_conf *config) {
+  int nthreads, nchunks = 0, nfiles, f, i, n, err, same, rc = EXIT_SUCCESS;
+  uint32_t crc;
+  long want, weight;
+  char *suffix;
+  const char *name;
+  struct outbuf *head, *part;
+  struct dhcpd_subnet *first[MAXTHREADS * 4 + 1];
+  long chunk_weight[MAXTHREADS * 4];
+  struct iovec iov[MAXTHREADS * 4 + 2];
+  struct render_job job;
+  struct dhcpd_param *pa;
+  struct dhcpd_subnet *sn;
+  struct conf_include *inc;
+  struct tm *s_suffix;
+  struct timespec t;
+  time_t tm_t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  memset(&last_save, 0, sizeof(struct save_times));
+  tm_t = time(NULL);
+  s_suffix = localtime(&tm_t);
+  suffix = xmalloc(18);
+  if ( strftime(suffix, 17, "-%Y%m%d-%H%M%S", s_suffix) == 0 ) {
+    free(suffix);
+    return EXIT_FAILURE;
+  }
+  nfiles = ( config->nfiles > 0 ) ? config->nfiles : 1;
+  /* cut the subnet list in runs of about the same weight */
+  nthreads = worker_count();
+  want = ( config->nsubnets + config->nhosts ) / ( nthreads * 4 );
+  if ( want < RENDER_CHUNK )
+    want = RENDER_CHUNK;
+  if ( nthreads == 1 || config->nsubnets + config->nhosts < 2 * want )
+    want = LONG_MAX;
+  weight = 0;
+  for ( sn = config->subnets; sn != NULL; sn = sn->next ) {
+    if ( weight == 0 )
+      first[nchunks] = sn;
+    weight += 1 + sn->nhosts;
+    if ( weight >= want && nchunks < nthreads * 4 - 1 ) {
+      chunk_weight[nchunks++] = weight;
+      weight = 0;
+    }
+  }
+  if ( weight > 0 )
+    chunk_weight[nchunks++] = weight;
+  first[nchunks] = NULL;
+  head = xmalloc(sizeof(struct outbuf) * nfiles);
+  memset(head, 0, sizeof(struct outbuf) * nfiles);
+  part = xmalloc(sizeof(struct outbuf) * nfiles * ( nchunks + 1 ));
+  memset(part, 0, sizeof(struct outbuf) * nfiles * ( nchunks + 1 ));
+  job.shared = xmalloc(sizeof(int) * nfiles);
+  job.scope = xmalloc(sizeof(struct dhcpd_subnet *) * nfiles);
+  for ( f = 0; f < nfiles; f++ ) {
+    job.shared[f] = 0;
+    job.scope[f] = NULL;
+    if ( f == 0 ) {
+      ob_printf(&head[f], "# %s: dhcpd.conf auto generated\n", program_invocation_short_name);
+    } else {
+      if ( config->files[f]->scope != NULL )
+	job.scope[f] = subnet_get(config, config->files[f]->scope);
+      name = strrchr(config->files[f]->path, '/');
+      ob_printf(&head[f], "# %s: %s auto generated\n", program_invocation_short_name,
+		( name != NULL ) ? name + 1 : config->files[f]->path);
+    }
+  }
+  for ( pa = config->globals.first; pa != NULL; pa = pa->next ) {
+    f = file_slot(config, pa->file);
+    if ( strcmp(pa->name, "shared-network") == 0 ) {
+      /* especific rule just for shared-network reserved word */
+      job.shared[f] = 1;
+      ob_printf(&head[f], "# %s: You have to use dot1q instead shared network.\n%s %s {\n", program_invocation_short_name, pa->name, pa->value);
+    } else {
+      ob_param(&head[f], "", pa);
+    }
+  }
+  for ( inc = config->includes; inc != NULL; inc = inc->next )
+    if ( inc->scope == NULL )
+      ob_printf(&head[file_slot(config, inc->parent)], "%sinclude \"%s\";\n",
+		job.shared[file_slot(config, inc->parent)] ? "  " : "", inc->name);
+  job.next = 0;
+  job.count = nchunks;
+  job.first = first;
+  job.weight = chunk_weight;
+  job.part = part;
+  job.config = config;
+  job.nfiles = nfiles;
+  pthread_mutex_init(&job.lock, NULL);
+  last_save.threads = run_workers(( nthreads < nchunks ) ? nthreads : nchunks, render_worker, &job);
+  pthread_mutex_destroy(&job.lock);
+  /* the last row of buffers closes shared-network blocks */
+  for ( f = 0; f < nfiles; f++ )
+    if ( job.shared[f] )
+      ob_puts(&part[nchunks * nfiles + f], "}\n");
+  last_save.render = lap(&t);
+#ifdef _DEBUG
+  endwin();
+#endif
+  /* included files first, dhcpd.conf is always written */
+  for ( f = nfiles - 1; f >= 0 && rc == EXIT_SUCCESS; f-- ) {
+    iov[0].iov_base = head[f].data;
+    iov[0].iov_len = head[f].len;
+    for ( n = 1, i = 0; i <= nchunks; i++ ) {
+      if ( part[i * nfiles + f].len > 0 ) {
+	iov[n].iov_base = part[i * nfiles + f].data;
+	iov[n++].iov_len = part[i * nfiles + f].len;
+      }
+    }
+#if defined( _DEBUG ) && !defined( _INFO )
+    for ( i = 0; i < n; i++ )
+      fwrite(iov[i].iov_base, 1, iov[i].iov_len, stdout);
+#endif
+    crc = crc32(0L, Z_NULL, 0);
+    for ( i = 0; i < n; i++ )
+      crc = crc32(crc, iov[i].iov_base, iov[i].iov_len);
+    name = ( f > 0 ) ? config->files[f]->path : filename;
+    same = f > 0 && file_same(name, iov, n);
+    if ( ! same )
+      rc = write_config_file(name, suffix, iov, n, &t);
+    if ( rc == EXIT_SUCCESS && config->nfiles > 0 )
+      file_saved(config->files[f], name, crc, ! same);
+  }
+  err = errno;
+  if ( rc == EXIT_SUCCESS && config->nfiles > 0 && strcmp(config->files[0]->path, filename) == 0 )
+    model_cache_write(config, filename);
+  STAT_TIME(T_SAVE, last_save.render + last_save.backup + last_save.write + last_save.sync + last_save.rename);
+  STAT_TIME(T_BACKUP, last_save.backup);
+  STAT_TIME(T_WRITE, last_save.write + last_save.sync + last_save.rename);
+  for ( i = 0; i < nfiles * ( nchunks + 1 ); i++ )
+    ob_free(&part[i]);
+  for ( f = 0; f < nfiles; f++ )
+    ob_free(&head[f]);
+  free(part);
+  free(head);
+  free(job.shared);
+  free(job.scope);
+  free(suffix);
+#ifdef _DEBUG
+  if ( rc == EXIT_SUCCESS )
+    (void) initscr();
+#endif
+  errno = err;
+  return rc;
+}
+
+/* Checks dhcpd does when it starts, made before it refuses to: subnets
+ * overlapping, ranges out of their subnet, fixed addresses inside a
+ * range and a MAC or fixed address reserved twice.  Subnets and ranges
+ * are uint32 intervals sorted by start, each one knowing the highest
+ * end up to it, so overlaps come from one sweep and the range holding
+ * an address from a binary search: O(n log n) for the whole file.
+ * The intervals are kept in the configuration, after an edit only
+ * those of the edited subnet are put again.  MACs and addresses are
+ * looked up in the host indexes.
+ */
+#define CHECK_SHOW  20   /* problems listed in a message */
+
+struct check_report {
+  long count;
+  size_t shown;                /* text of the first CHECK_SHOW problems */
+  struct outbuf text;
+};
+
+static int subnet_bounds (struct dhcpd_subnet *sn, uint32_t *lo, uint32_t *hi) {
+  uint32_t mask;
+  if ( ! sn->has_net || sn->netmask == NULL || ! ip_aton(sn->netmask, &mask) )
+    return 0;
+  *lo = sn->net & mask;
+  *hi = *lo | ~mask;
+  return 1;
+}
+
+/* "[dynamic-bootp] low [high]" of a range statement. */
+static int range_bounds (const char *value, uint32_t *lo, uint32_t *hi) {
+  char word[2][16];
+  int n = 0;
+  size_t len;
+  while ( n < 2 ) {
+    while ( *value == ' ' || *value == '\t' )
+      value++;
+    if ( *value == 0x00 )
+      break;
+    for ( len = 0; value[len] && value[len] != ' ' && value[len] != '\t'; len++ )
+      ;
+    if ( len == 13 && strncmp(value, "dynamic-bootp", 13) == 0 && n == 0 ) {
+      value += len;
+      continue;
+    }
+    if ( len >= sizeof(word[0]) )
+      return 0;
+    memcpy(word[n], value, len);
+    word[n++][len] = 0x00; /* NULL */
+    value += len;
+  }
+  if ( n == 0 || ! ip_aton(word[0], lo) )
+    return 0;
+  if ( n == 1 )
+    *hi = *lo;
+  else if ( ! ip_aton(word[1], hi) )
+    return 0;
+  if ( *hi < *lo ) {
+    n = *lo;
+    *lo = *hi;
+    *hi = n;
+  }
+  return 1;
+}
+
+static void interval_add (struct interval_index *ix, uint32_t lo, uint32_t hi,
+			  struct dhcpd_subnet *sn, struct dhcpd_param *pa) {
+  if ( ix->count == ix->size ) {
+    ix->size = ( ix->size > 0 ) ? 2 * ix->size : 256;
+    ix->iv = xrealloc(ix->iv, sizeof(struct interval) * ix->size);
+  }
+  ix->iv[ix->count].lo = lo;
+  ix->iv[ix->count].hi = hi;
+  ix->iv[ix->count].sn = sn;
+  ix->iv[ix->count++].pa = pa;
+}
+
+static int interval_cmp (const void *a, const void *b) {
+  const struct interval *x = a, *y = b;
+  if ( x->lo != y->lo )
+    return ( x->lo < y->lo ) ? -1 : 1;
+  return ( x->hi > y->hi ) ? -1 : ( x->hi < y->hi );
+}
+
+/* Highest end up to each interval, from the first one to change. */
+static void interval_reach (struct interval_index *ix, long from) {
+  long i;
+  for ( i = ( from > 0 ) ? from : 0; i < ix->count; i++ ) {
+    if ( i > 0 && ix->iv[i - 1].maxhi >= ix->iv[i].hi ) {
+      ix->iv[i].maxhi = ix->iv[i - 1].maxhi;
+      ix->iv[i].maxat = ix->iv[i - 1].maxat;
+    } else {
+      ix->iv[i].maxhi = ix->iv[i].hi;
+      ix->iv[i].maxat = i;
+    }
+  }
+}
+
+static void interval_sort (struct interval_index *ix) {
+  qsort(ix->iv, ix->count, sizeof(struct interval), interval_cmp);
+  interval_reach(ix, 0);
+}
+
+/* Put the intervals of sn again, the others keep their order.  Returns
+ * the first position that changed.
+ */
+static long interval_drop (struct interval_index *ix, struct dhcpd_subnet *sn) {
+  long i, j, first = ix->count;
+  for ( i = j = 0; i < ix->count; i++ ) {
+    if ( ix->iv[i].sn == sn ) {
+      if ( first > i )
+	first = i;
+      continue;
+    }
+    ix->iv[j++] = ix->iv[i];
+  }
+  ix->count = j;
+  return first;
+}
+
+static long interval_insert (struct interval_index *ix, uint32_t lo, uint32_t hi,
+			     struct dhcpd_subnet *sn, struct dhcpd_param *pa) {
+  struct interval iv;
+  long i;
+  interval_add(ix, lo, hi, sn, pa);
+  iv = ix->iv[--ix->count];
+  for ( i = ix->count; i > 0 && interval_cmp(&ix->iv[i - 1], &iv) > 0; i-- )
+    ;
+  memmove(ix->iv + i + 1, ix->iv + i, sizeof(struct interval) * ( ix->count - i ));
+  ix->iv[i] = iv;
+  ix->count++;
+  return i;
+}
+
+/* Last interval starting at or below ip, -1 for none. */
+static long interval_lower (struct interval_index *ix, uint32_t ip) {
+  long lo = 0, hi = ix->count, mid;
+  while ( lo < hi ) {
+    mid = lo + ( hi - lo ) / 2;
+    if ( ix->iv[mid].lo <= ip )
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo - 1;
+}
+
+/* An interval holding ip, NULL for none. */
+static struct interval *interval_find (struct interval_index *ix, uint32_t ip) {
+  long i = interval_lower(ix, ip);
+  if ( i < 0 || ix->iv[i].maxhi < ip )
+    return NULL;
+  return &ix->iv[ix->iv[i].maxat];
+}
+
+static void check_note (struct check_report *cr, const char *fmt, ...) {
+  va_list ap;
+  char line[512];
+  va_start (ap, fmt);
+  vsnprintf(line, sizeof(line), fmt, ap);
+  va_end (ap);
+  ob_puts(&cr->text, line);
+  ob_puts(&cr->text, "\n");
+  if ( ++cr->count == CHECK_SHOW )
+    cr->shown = cr->text.len;
+}
+
+/* Every pair of hosts sharing a key is told once, by the later one,
+ * unless the earlier one is outside the subnet being checked.
+ */
+static inline int check_pair (struct dhcpd_host *ho, struct dhcpd_host *other, struct dhcpd_subnet *only) {
+  return other != ho && ( other->seq < ho->seq || ( only != NULL && other->subnet != only ) );
+}
+
+static void check_host (struct dhcpd_conf *config, struct dhcpd_host *ho,
+			struct dhcpd_subnet *only, struct check_report *cr) {
+  struct dhcpd_host *other = NULL;
+  struct interval *in;
+  while ( ho->has_mac && ( other = index_next(&config->by_mac, other, ho->mac, KEY_MAC) ) != NULL )
+    if ( check_pair(ho, other, only) )
+      check_note(cr, "MAC %s of host %s in %s is also used by host %s in %s", ho->hardware,
+		 ho->name, ho->subnet->network, other->name, other->subnet->network);
+  if ( ! ho->has_ip )
+    return;
+  while ( ( other = index_next(&config->by_ip, other, ho->ip, KEY_IP) ) != NULL )
+    if ( check_pair(ho, other, only) )
+      check_note(cr, "Address %s of host %s in %s is also fixed for host %s in %s", ho->address,
+		 ho->name, ho->subnet->network, other->name, other->subnet->network);
+  if ( ( in = interval_find(&config->ranges, ho->ip) ) != NULL )
+    check_note(cr, "Address %s of host %s in %s is inside range %s of %s", ho->address,
+	       ho->name, ho->subnet->network, in->pa->value, in->sn->network);
+}
+
+/* Intervals of sn, appended or inserted in order. */
+static long check_intervals (struct dhcpd_conf *config, struct dhcpd_subnet *sn, int insert) {
+  struct dhcpd_param *pa;
+  uint32_t lo, hi;
+  long first = config->nets.count + config->ranges.count, at;
+  if ( subnet_bounds(sn, &lo, &hi) ) {
+    if ( insert )
+      first = interval_insert(&config->nets, lo, hi, sn, NULL);
+    else
+      interval_add(&config->nets, lo, hi, sn, NULL);
+  }
+  for ( pa = sn->params.first; pa != NULL; pa = pa->next ) {
+    if ( ! param_is_range(pa) || ! range_bounds(pa->value, &lo, &hi) )
+      continue;
+    if ( insert && ( at = interval_insert(&config->ranges, lo, hi, sn, pa) ) < first )
+      first = at;
+    else if ( ! insert )
+      interval_add(&config->ranges, lo, hi, sn, pa);
+  }
+  return first;
+}
+
+static void check_ranges (struct dhcpd_subnet *sn, struct check_report *cr) {
+  struct dhcpd_param *pa;
+  uint32_t lo, hi, slo, shi;
+  if ( ! subnet_bounds(sn, &slo, &shi) )
+    return;
+  for ( pa = sn->params.first; pa != NULL; pa = pa->next )
+    if ( param_is_range(pa) && range_bounds(pa->value, &lo, &hi) && ( lo < slo || hi > shi ) )
+      check_note(cr, "Range %s is outside subnet %s/%s", pa->value, sn->network, sn->netmask);
+}
+
+/* Check the whole configuration, or only what only touches when it is
+ * not NULL, and add the problems found to cr.  Returns their count.
+ * A check of only is made after only was edited and puts its
+ * intervals again, anything else changing subnets clears checks_valid.
+ */
+long check_config (struct dhcpd_conf *config, struct dhcpd_subnet *only, struct check_report *cr) {
+  struct interval_index *nets = &config->nets;
+  struct dhcpd_subnet *sn;
+  struct dhcpd_host *ho;
+  struct interval *a, *b;
+  long i, j, from;
+  STAT_START(t0);
+  if ( ! config->checks_valid ) {
+    nets->count = config->ranges.count = 0;
+    for ( sn = config->subnets; sn != NULL; sn = sn->next )
+      check_intervals(config, sn, 0);
+    interval_sort(nets);
+    interval_sort(&config->ranges);
+    config->checks_valid = 1;
+  } else if ( only != NULL ) {
+    from = interval_drop(nets, only);
+    if ( ( i = interval_drop(&config->ranges, only) ) < from )
+      from = i;
+    if ( ( i = check_intervals(config, only, 1) ) < from )
+      from = i;
+    /* positions shifted from the first one dropped or put */
+    interval_reach(nets, from);
+    interval_reach(&config->ranges, from);
+  }
+  if ( only != NULL ) {
+    check_ranges(only, cr);
+  } else {
+    for ( sn = config->subnets; sn != NULL; sn = sn->next )
+      check_ranges(sn, cr);
+  }
+  for ( i = 1; i < nets->count; i++ ) {
+    if ( nets->iv[i].lo > nets->iv[i - 1].maxhi )
+      continue;
+    a = &nets->iv[nets->iv[i - 1].maxat];
+    b = &nets->iv[i];
+    if ( only == NULL || b->sn == only )
+      check_note(cr, "Subnet %s/%s overlaps subnet %s/%s", b->sn->network, b->sn->netmask,
+		 a->sn->network, a->sn->netmask);
+  }
+  /* the sweep names one earlier subnet, later ones inside only are missing */
+  for ( j = 0; only != NULL && j < nets->count; j++ ) {
+    if ( nets->iv[j].sn != only )
+      continue;
+    for ( i = j + 1; i < nets->count && nets->iv[i].lo <= nets->iv[j].hi; i++ )
+      check_note(cr, "Subnet %s/%s overlaps subnet %s/%s", nets->iv[i].sn->network,
+		 nets->iv[i].sn->netmask, only->network, only->netmask);
+  }
+  if ( only != NULL ) {
+    for ( ho = only->hosts; ho != NULL; ho = ho->next )
+      check_host(config, ho, only, cr);
+  } else {
+    for ( sn = config->subnets; sn != NULL; sn = sn->next )
+      for ( ho = sn->hosts; ho != NULL; ho = ho->next )
+	check_host(config, ho, NULL, cr);
+  }
+  STAT_STOP(T_CHECK, t0);
+  return cr->count;
+}
+
+/* The problems as a message, the first CHECK_SHOW of them. */
+static char *check_message (struct check_report *cr, const char *question) {
+  return arena_printf(&scratch, "\n%li problem%s dhcpd would refuse:\n\n%.*s%s\n%s",
+		      cr->count, ( cr->count == 1 ) ? "" : "s",
+		      (int) ( ( cr->count > CHECK_SHOW ) ? cr->shown : cr->text.len ), cr->text.data,
+		      ( cr->count > CHECK_SHOW ) ? "...\n" : "", question);
+}
+
+/* Recheck a subnet after it changed, problems are only shown. */
+static void check_warn (const char *title, struct dhcpd_conf *config, struct dhcpd_subnet *sn) {
+  struct check_report cr;
+  memset(&cr, 0, sizeof(struct check_report));
+  if ( check_config(config, sn, &cr) > 0 )
+    dialog_msgbox(title, check_message(&cr, "Fix them before saving."), 22, 72, true);
+  ob_free(&cr.text);
+}
+
+/* Search as you type for long menus.  Every entry (tag and item) is
+ * indexed by its trigrams, hashed to FILTER_BUCKETS lists of entry
+ * numbers.  A filter of three or more characters only checks the
+ * entries in the shortest list of its trigrams, a filter extending the
+ * previous one only checks the entries that matched before.
+ */
+#define FILTER_MIN      200   /* entries before a menu gets the filter */
+#define FILTER_BUCKETS  65536
+
+struct filter_index {
+  int count;
+  char **text;           /* lowercase "tag item" of each entry */
+  int *offset, *entry;   /* bucket b lists entry[offset[b]] up to entry[offset[b+1]] */
+  int nmatch, *match;
+  char query[64];
+};
+
+static inline int trigram_bucket (const char *s) {
+  return ( (unsigned char) s[0] * 961 + (unsigned char) s[1] * 31 + (unsigned char) s[2] ) &
+    ( FILTER_BUCKETS - 1 );
+}
+
+static void filter_build (struct filter_index *fi, int count, char **menu) {
+  int i, b, *last, *pos;
+  char *p;
+  STAT_START(t0);
+  fi->count = count;
+  fi->text = arena_alloc(&scratch, sizeof(char *) * count);
+  for ( i = 0; i < count; i++ ) {
+    fi->text[i] = arena_printf(&scratch, "%s %s", menu[2 * i], menu[2 * i + 1]);
+    for ( p = fi->text[i]; *p; p++ )
+      if ( *p >= 'A' && *p <= 'Z' )
+	*p += 'a' - 'A';
+  }
+  fi->offset = xmalloc(sizeof(int) * ( FILTER_BUCKETS + 1 ));
+  pos = xmalloc(sizeof(int) * FILTER_BUCKETS);
+  last = xmalloc(sizeof(int) * FILTER_BUCKETS);
+  memset(fi->offset, 0, sizeof(int) * ( FILTER_BUCKETS + 1 ));
+  /* count, then fill, each entry once per bucket */
+  memset(last, 0xff, sizeof(int) * FILTER_BUCKETS);
+  for ( i = 0; i < count; i++ )
+    for ( p = fi->text[i]; p[0] && p[1] && p[2]; p++ )
+      if ( last[b = trigram_bucket(p)] != i ) {
+	last[b] = i;
+	fi->offset[b + 1]++;
+      }
+  for ( b = 0; b < FILTER_BUCKETS; b++ )
+    fi->offset[b + 1] += fi->offset[b];
+  fi->entry = xmalloc(sizeof(int) * ( fi->offset[FILTER_BUCKETS] + 1 ));
+  memcpy(pos, fi->offset, sizeof(int) * FILTER_BUCKETS);
+  memset(last, 0xff, sizeof(int) * FILTER_BUCKETS);
+  for ( i = 0; i < count; i++ )
+    for ( p = fi->text[i]; p[0] && p[1] && p[2]; p++ )
+      if ( last[b = trigram_bucket(p)] != i ) {
+	last[b] = i;
+	fi->entry[pos[b]++] = i;
+      }
+  free(pos);
+  free(last);
+  fi->match = xmalloc(sizeof(int) * ( count + 1 ));
+  for ( i = 0; i < count; i++ )
+    fi->match[i] = i;
+  fi->nmatch = count;
+  fi->query[0] = 0x00; /* NULL */
+  STAT_STOP(T_FILTER, t0);
+}
+
+static void filter_free (struct filter_index *fi) {
+  free(fi->offset);
+  free(fi->entry);
+  free(fi->match);
+}
+
+/* Entries containing query, in menu order. */
+static void filter_query (struct filter_index *fi, const char *query) {
+  char q[sizeof(fi->query)];
+  int i, n, e, b, len, *cand = NULL, ncand;
+  STAT_START(t0);
+  for ( len = 0; query[len] && len < (int) sizeof(q) - 1; len++ )
+    q[len] = ( query[len] >= 'A' && query[len] <= 'Z' ) ? query[len] + 'a' - 'A' : query[len];
+  q[len] = 0x00; /* NULL */
+  if ( fi->query[0] != 0x00 && strncmp(q, fi->query, strlen(fi->query)) == 0 ) {
+    /* narrowing, the new matches are among the old ones */
+    cand = fi->match;
+    ncand = fi->nmatch;
+  } else {
+    ncand = fi->count;
+  }
+  for ( i = 0; i + 2 < len; i++ ) {
+    b = trigram_bucket(q + i);
+    if ( fi->offset[b + 1] - fi->offset[b] < ncand ) {
+      cand = fi->entry + fi->offset[b];
+      ncand = fi->offset[b + 1] - fi->offset[b];
+    }
+  }
+  /* cand may be fi->match itself, n never passes i */
+  for ( i = n = 0; i < ncand; i++ ) {
+    e = ( cand != NULL ) ? cand[i] : i;
+    if ( strstr(fi->text[e], q) != NULL )
+      fi->match[n++] = e;
+  }
+  fi->nmatch = n;
+  strcpy(fi->query, q);
+  STAT_STOP(T_FILTER, t0);
+}
+
+/* Same as dialog_menu, long lists get a filter line on top that
+ * narrows the list while typing.  The window is laid out again to fit
+ * the screen when the terminal is resized.
+ */
+int filter_dialog_menu (const char *title, const char *cprompt, int height, int width,
+			int menu_height, int item_no, char **items) {
+  struct filter_index fi;
+  WINDOW *win = NULL;
+  int top = 0, cur = 0, len = 0, ch, i, rc = -1, h = 0, w = 0, rows = 1, iw = 1;
+  char query[sizeof(fi.query)] = "";
+  if ( item_no <= FILTER_MIN )
+    return dialog_menu(title, cprompt, height, width, menu_height, item_no, items);
+  filter_build(&fi, item_no, items);
+  while ( rc == -1 ) {
+    if ( win == NULL ) {
+      /* no bigger than the screen, list rows and item text shrink */
+      h = ( height < LINES ) ? height : LINES;
+      w = ( width < COLS ) ? width : COLS;
+      rows = ( menu_height - 2 < h - 7 ) ? menu_height - 2 : h - 7;
+      if ( rows < 1 )
+	rows = 1;
+      iw = ( w > 30 ) ? w - 29 : 1;
+      win = newwin(h, w, ( LINES - h ) / 2, ( COLS - w ) / 2);
+      keypad(win, TRUE);
+    }
+    if ( cur < 0 )
+      cur = 0;
+    if ( cur < top )
+      top = cur;
+    else if ( cur >= top + rows )
+      top = cur - rows + 1;
+    werase(win);
+    box(win, 0, 0);
+    mvwaddnstr(win, 0, 2, title, w - 4);
+    mvwaddnstr(win, 1, 2, cprompt, w - 4);
+    mvwprintw(win, 3, 2, "%i of %i", fi.nmatch, item_no);
+    for ( i = 0; i < rows && top + i < fi.nmatch; i++ ) {
+      if ( top + i == cur )
+	wattron(win, A_REVERSE);
+      mvwprintw(win, 5 + i, 2, "%-24.24s %-*.*s", items[2 * fi.match[top + i]],
+		iw, iw, items[2 * fi.match[top + i] + 1]);
+      if ( top + i == cur )
+	wattroff(win, A_REVERSE);
+    }
+    mvwaddnstr(win, h - 2, 2, "Enter: choose  Esc: cancel  Type to filter", w - 4);
+    mvwprintw(win, 2, 2, "Filter: %s", query);
+    wrefresh(win);
+    switch ( ch = wgetch(win) ) {
+    case 27 :
+      rc = 1;
+      break;
+    case '\n' :
+    case '\r' :
+    case KEY_ENTER :
+      if ( fi.nmatch > 0 ) {
+	dlg_add_result(items[2 * fi.match[cur]]);
+	rc = 0;
       }
-    skipoption:
-      /* reallocating gs memory because as_rex reallocates it */
-      gs = (char *) xrealloc (gs, BUFSIZ);
+      break;
+    case KEY_UP :
+      cur -= ( cur > 0 );
+      break;
+    case KEY_DOWN :
+      cur += ( cur < fi.nmatch - 1 );
+      break;
+    case KEY_PPAGE :
+      cur = ( cur > rows ) ? cur - rows : 0;
+      break;
+    case KEY_NPAGE :
+      cur = ( cur + rows < fi.nmatch ) ? cur + rows : fi.nmatch - 1;
+      break;
+    case KEY_RESIZE :
+      /* as dialog's own widgets do: clear, then lay out again */
+      dlg_will_resize(win);
+      delwin(win);
+      win = NULL;
+      dlg_clear();
+      refresh();
+      break;
+    case KEY_BACKSPACE :
+    case 127 :
+    case 8 :
+      if ( len > 0 ) {
+	query[--len] = 0x00; /* NULL */
+	filter_query(&fi, query);
+	cur = top = 0;
+      }
+      break;
+    default :
+      if ( ch >= 0x20 && ch < 0x7f && len < (int) sizeof(query) - 1 ) {
+	query[len++] = ch;
+	query[len] = 0x00; /* NULL */
+	filter_query(&fi, query);
+	cur = top = 0;
+      }
+    }
+  }
+  delwin(win);
+  touchwin(stdscr);
+  refresh();
+  filter_free(&fi);
+  return rc;
+}
+
+
+/* Canonical text in buf of an address typed in a form, NULL after
+ * telling so when it is not one.
+ */
+static char *form_mac (const char *title, const char *s, char *buf) {
+  uint64_t mac;
+  if ( mac_aton(s, &mac) )
+    return mac_ntoa(mac, buf);
+  dialog_msgbox(title, arena_printf(&scratch, "\n\"%s\" is not a MAC address, six hex octets colon separated.\n", s),
+		22, 72, true);
+  return NULL;
+}
+
+static char *form_ip (const char *title, const char *label, const char *s, char *buf) {
+  uint32_t ip;
+  if ( ip_aton(s, &ip) )
+    return ip_ntoa(ip, buf);
+  dialog_msgbox(title, arena_printf(&scratch, "\n%s \"%s\" is not an IPv4 address.\n", label, s),
+		22, 72, true);
+  return NULL;
+}
+
+/* Tell the user the MAC or IP is reserved by another host, returns 1
+ * if there was a conflict.
+ */
+static int host_conflict (const char *title, struct dhcpd_conf *config, struct dhcpd_host *except,
+			  const char *hardware, const char *address) {
+  struct dhcpd_host *ho;
+  char *mesg;
+  if ( ( ho = host_find_mac(config, hardware, except) ) != NULL )
+    mesg = arena_printf(&scratch, "\nMAC address %s is already reserved by host %s in subnet %s.\n",
+			  hardware, ho->name, ho->subnet->network);
+  else if ( ( ho = host_find_ip(config, address, except) ) != NULL )
+    mesg = arena_printf(&scratch, "\nIP address %s is already reserved by host %s in subnet %s.\n",
+			  address, ho->name, ho->subnet->network);
+  else
+    return 0;
+  dialog_msgbox(title, mesg, 22, 72, true);
+  return 1;
+}
+
+/* Form field cleanup, done in place.  Hostnames keep alphanumerics
+ * and dashes.  In MAC addresses every run of dots or dashes becomes a
+ * colon and anything else but hex digits and colons is dropped.  IP
+ * addresses lose surrounding blanks and every run of non digits
+ * becomes a dot.
+ */
+char *clean_hostname (char *s) {
+  char *r, *w;
+  for ( r = w = s; *r; r++ )
+    if ( ( *r >= 'A' && *r <= 'Z' ) || ( *r >= 'a' && *r <= 'z' ) ||
+	 ( *r >= '0' && *r <= '9' ) || *r == '-' )
+      *w++ = *r;
+  *w = 0x00; /* NULL */
+  return s;
+}
+
+char *clean_mac (char *s) {
+  char *r, *w;
+  int run = 0;
+  for ( r = w = s; *r; r++ ) {
+    if ( *r == '.' || *r == '-' ) {
+      if ( ! run )
+	*w++ = ':';
+      run = 1;
+      continue;
+    }
+    run = 0;
+    if ( ( *r >= 'A' && *r <= 'F' ) || ( *r >= 'a' && *r <= 'f' ) ||
+	 ( *r >= '0' && *r <= '9' ) || *r == ':' )
+      *w++ = *r;
+  }
+  *w = 0x00; /* NULL */
+  return s;
+}
+
+char *clean_ip (char *s) {
+  char *r, *w, *end;
+  int run = 0;
+  for ( r = s; *r == ' '; r++ );
+  for ( end = r + strlen(r); end > r && end[-1] == ' '; end-- );
+  for ( w = s; r < end; r++ ) {
+    if ( *r >= '0' && *r <= '9' ) {
+      *w++ = *r;
+      run = 0;
+    } else if ( ! run ) {
+      *w++ = '.';
+      run = 1;
+    }
+  }
+  *w = 0x00; /* NULL */
+  return s;
+}
+
+/* Host values form, shared by Edit and Find. */
+static int edit_host (const char *title, struct dhcpd_conf *config, struct dhcpd_host *ho) {
+  char **menu, **fminput, *mesg, mac[18], ip[16];
+  int menusz, fmcount, rok;
+  menu = manual_fast_menu(&menusz,
+			  "MAC Address :", "1", "1", ( ho->hardware != NULL ) ? ho->hardware : "", "1", "15", "17", "0",
+			  "IP Address  :", "2", "1", ( ho->address != NULL ) ? ho->address : "", "2", "15", "15", "0",
+			  NULL);
+  mesg = arena_printf(&scratch, "%s selected:", ho->name);
+  if (dialog_vars.input_result) dialog_vars.input_result[0] = '\0';
+  rok = dialog_form(title,
+		    mesg,
+		    22, 72, 14,
+		    menusz / 8, menu);
+  if ( rok == 0 ) {
+    fminput = split("\n", "", dialog_vars.input_result, &fmcount);
+    clean_mac(fminput[0]);
+    clean_ip(fminput[1]);
+    if ( form_mac(title, fminput[0], mac) != NULL && form_ip(title, "IP address", fminput[1], ip) != NULL &&
+	 ! host_conflict(title, config, ho, mac, ip) ) {
+      host_set(config, ho, mac, ip);
+      check_warn(title, config, ho->subnet);
     }
+    free_double_pointer(fminput, fmcount);
 #ifdef _DEBUG
+  } else {
+    endwin();
+    printf("Canceled.");
 # ifndef _INFO
-    printf("\nPress any key..."); getchar();
+    printf("\n\nPress any key..."); getchar();
 # endif
     (void) initscr();
 #endif
-    fclose(fstream);
+  }
+  return rok;
+}
+
+/* Next comma separated field of a CSV line without surrounding blanks
+ * or double quotes, the line is cut in place.  NULL past the last one.
+ */
+static char *csv_field (char **line) {
+  char *f = *line, *e;
+  if ( f == NULL )
+    return NULL;
+  if ( ( e = strchr(f, ',') ) != NULL ) {
+    *e = 0x00; /* NULL */
+    *line = e + 1;
+  } else {
+    e = f + strlen(f);
+    *line = NULL;
+  }
+  while ( *f == ' ' || *f == '\t' )
+    f++;
+  while ( e > f && ( e[-1] == ' ' || e[-1] == '\t' || e[-1] == '\r' ) )
+    *--e = 0x00; /* NULL */
+  if ( e - f >= 2 && *f == '"' && e[-1] == '"' ) {
+    e[-1] = 0x00; /* NULL */
+    f++;
+  }
+  return f;
+}
+
+/* A first row naming the columns, "hostname,mac,ip,subnet" or alike. */
+static int csv_heading (const char *name, const char *hardware, const char *address) {
+  return ( strcasecmp(name, "hostname") == 0 || strcasecmp(name, "host") == 0 ||
+	   strcasecmp(name, "name") == 0 ) &&
+    ( strncasecmp(hardware, "mac", 3) == 0 || strncasecmp(hardware, "hardware", 8) == 0 ) &&
+    ( strncasecmp(address, "ip", 2) == 0 || strcasecmp(address, "address") == 0 ||
+      strcasecmp(address, "fixed-address") == 0 );
+}
+
+/* Import hosts from a CSV of hostname, MAC, IP and subnet network,
+ * cleaned up as the Create form does.  Bad rows are reported on stderr
+ * and skipped; blank lines, comments and a heading row are ignored.
+ * Returns the number of rejected rows, -1 if the file can't be read.
+ */
+long import_hosts_csv (struct dhcpd_conf *config, const char *filename, long *imported) {
+  size_t size;
+  long lineno = 0, rejected = 0;
+  int first = 1;
+  char *buf, *line, *next, *rest, *name, *hardware, *address, *network;
+  char why[256], macbuf[18], ipbuf[16];
+  uint64_t mac;
+  uint32_t ip, mask;
+  struct dhcpd_subnet *sn;
+  struct dhcpd_host *ho, *self;
+  *imported = 0;
+  if ( ( buf = load_file(filename, &size) ) == NULL )
+    return -1;
+  for ( line = buf; line != NULL; line = next ) {
+    lineno++;
+    if ( ( next = strchr(line, '\n') ) != NULL )
+      *next++ = 0x00; /* NULL */
+    rest = line;
+    name = csv_field(&rest);
+    if ( *name == 0x00 || *name == '#' )
+      continue;
+    hardware = csv_field(&rest);
+    address = csv_field(&rest);
+    network = csv_field(&rest);
+    if ( first ) {
+      first = 0;
+      if ( address != NULL && csv_heading(name, hardware, address) )
+	continue;
+    }
+    if ( network == NULL ) {
+      snprintf(why, sizeof(why), "expected hostname,MAC,IP,subnet");
+      goto reject;
+    }
+    clean_hostname(name);
+    clean_mac(hardware);
+    clean_ip(address);
+    if ( ( rest = strchr(network, '/') ) != NULL )
+      *rest = 0x00; /* NULL */
+    if ( ! mac_aton(hardware, &mac) ) {
+      snprintf(why, sizeof(why), "bad MAC address %s", hardware);
+      goto reject;
+    }
+    if ( *name == 0x00 ) {
+      snprintf(why, sizeof(why), "empty hostname");
+      goto reject;
+    }
+    if ( ! ip_aton(address, &ip) ) {
+      snprintf(why, sizeof(why), "bad IP address %s", address);
+      goto reject;
+    }
+    if ( ( sn = subnet_get(config, network) ) == NULL ) {
+      snprintf(why, sizeof(why), "no subnet %s", network);
+      goto reject;
+    }
+    if ( sn->has_net && ip_aton(sn->netmask, &mask) && ( ip & mask ) != ( sn->net & mask ) ) {
+      snprintf(why, sizeof(why), "%s is not in subnet %s/%s", address, sn->network, sn->netmask);
+      goto reject;
+    }
+    self = host_get(config, sn, name);
+    if ( ( ho = host_find_mac(config, hardware, self) ) != NULL ) {
+      snprintf(why, sizeof(why), "MAC address %s is already reserved by host %s in subnet %s",
+	       hardware, ho->name, ho->subnet->network);
+      goto reject;
+    }
+    if ( ( ho = host_find_ip(config, address, self) ) != NULL ) {
+      snprintf(why, sizeof(why), "IP address %s is already reserved by host %s in subnet %s",
+	       address, ho->name, ho->subnet->network);
+      goto reject;
+    }
+    host_put(config, sn, name, mac_ntoa(mac, macbuf), ip_ntoa(ip, ipbuf));
+    (*imported)++;
+    continue;
+  reject:
+    fprintf(stderr, "%s:%li: %s\n", filename, lineno, why);
+    rejected++;
+  }
+  free(buf);
+  return rejected;
+}
+
+/* Structural diff, what saving new over old would change.  Subnets
+ * are matched by network and hosts by name within their subnet, only
+ * blocks that differ are rendered and diffed line by line, in hunks
+ * headed by their subnet.  Comments and layout are not kept by the
+ * model, so changes to them never show.
+ */
+#define DIFF_LCS_MAX  256   /* longer blocks are shown all removed, all added */
+
+struct diff_out {
+  struct outbuf ob;
+  char *hunk;    /* header to print before the next change */
+  long blocks;   /* blocks that differ */
+};
+
+static int str_same (const char *a, const char *b) {
+  return ( a == NULL || b == NULL ) ? a == b : strcmp(a, b) == 0;
+}
+
+/* Same statements in the same order, range numbers do not count. */
+static int params_same (struct dhcpd_params *a, struct dhcpd_params *b) {
+  struct dhcpd_param *p, *q;
+  for ( p = a->first, q = b->first; p != NULL && q != NULL; p = p->next, q = q->next ) {
+    if ( param_is_range(p) != param_is_range(q) ||
+	 ( ! param_is_range(p) && strcmp(p->name, q->name) != 0 ) || strcmp(p->value, q->value) != 0 )
+      return 0;
+  }
+  return p == q;
+}
+
+static int host_same (struct dhcpd_host *a, struct dhcpd_host *b) {
+  return str_same(a->hardware, b->hardware) && str_same(a->address, b->address) &&
+    params_same(&a->params, &b->params);
+}
+
+/* Start of each line of ob, *n of them, and its end after the last. */
+static char **diff_lines (struct outbuf *ob, int *n) {
+  char **line, *c, *end = ob->data + ob->len;
+  int i;
+  for ( *n = 0, c = ob->data; ( c = memchr(c, '\n', end - c) ) != NULL; c++ )
+    (*n)++;
+  line = xmalloc(sizeof(char *) * ( *n + 1 ));
+  line[0] = ob->data;
+  for ( i = 1, c = ob->data; i < *n; i++ )
+    line[i] = c = (char *) memchr(c, '\n', end - c) + 1;
+  line[*n] = end;
+  return line;
+}
+
+static inline int line_same (char **a, int i, char **b, int j) {
+  return a[i + 1] - a[i] == b[j + 1] - b[j] && memcmp(a[i], b[j], a[i + 1] - a[i]) == 0;
+}
+
+static void diff_emit (struct diff_out *d, char mark, char **line, int i) {
+  ob_write(&d->ob, &mark, 1);
+  ob_write(&d->ob, line[i], line[i + 1] - line[i]);
+}
+
+/* Diff of an old and a new rendering of one block, either may be
+ * empty.  Longest common subsequence of lines for blocks of a sane
+ * size, the table holds the LCS of every pair of suffixes.
+ */
+static void diff_block (struct diff_out *d, struct outbuf *old, struct outbuf *new) {
+  char **a, **b;
+  int n, m, i, j;
+  unsigned short *lcs = NULL;
+  if ( old->len == new->len && ( old->len == 0 || memcmp(old->data, new->data, old->len) == 0 ) ) {
+    old->len = new->len = 0;
+    return;
+  }
+  if ( d->hunk != NULL ) {
+    ob_printf(&d->ob, "@@ %s @@\n", d->hunk);
+    d->hunk = NULL;
+  }
+  d->blocks++;
+  a = diff_lines(old, &n);
+  b = diff_lines(new, &m);
+  if ( n > 0 && m > 0 && n <= DIFF_LCS_MAX && m <= DIFF_LCS_MAX ) {
+    lcs = xmalloc(sizeof(unsigned short) * ( n + 1 ) * ( m + 1 ));
+    for ( i = n; i >= 0; i-- ) {
+      for ( j = m; j >= 0; j-- ) {
+	if ( i == n || j == m )
+	  lcs[i * ( m + 1 ) + j] = 0;
+	else if ( line_same(a, i, b, j) )
+	  lcs[i * ( m + 1 ) + j] = lcs[( i + 1 ) * ( m + 1 ) + j + 1] + 1;
+	else if ( lcs[( i + 1 ) * ( m + 1 ) + j] >= lcs[i * ( m + 1 ) + j + 1] )
+	  lcs[i * ( m + 1 ) + j] = lcs[( i + 1 ) * ( m + 1 ) + j];
+	else
+	  lcs[i * ( m + 1 ) + j] = lcs[i * ( m + 1 ) + j + 1];
+      }
+    }
+  }
+  for ( i = j = 0; i < n || j < m; ) {
+    if ( lcs != NULL && i < n && j < m && line_same(a, i, b, j) ) {
+      diff_emit(d, ' ', a, i++);
+      j++;
+    } else if ( i < n && ( j == m || lcs == NULL ||
+			   lcs[( i + 1 ) * ( m + 1 ) + j] >= lcs[i * ( m + 1 ) + j + 1] ) ) {
+      diff_emit(d, '-', a, i++);
+    } else {
+      diff_emit(d, '+', b, j++);
+    }
+  }
+  free(lcs);
+  free(a);
+  free(b);
+  old->len = new->len = 0;
+}
+
+static void diff_subnet_head (struct outbuf *ob, struct dhcpd_subnet *sn) {
+  struct dhcpd_param *pa;
+  ob_printf(ob, "subnet %s netmask %s {\n", sn->network, sn->netmask);
+  for ( pa = sn->params.first; pa != NULL; pa = pa->next )
+    ob_param(ob, "  ", pa);
+}
+
+/* A whole subnet, hosts included, added or removed. */
+static void diff_subnet_whole (struct diff_out *d, struct dhcpd_subnet *sn, struct outbuf *ob, int added) {
+  struct outbuf none;
+  struct dhcpd_host *ho;
+  memset(&none, 0, sizeof(struct outbuf));
+  ob_init(&none, 0);
+  diff_subnet_head(ob, sn);
+  for ( ho = sn->hosts; ho != NULL; ho = ho->next )
+    ob_host(ob, ho, "", "    ");
+  ob_puts(ob, "}\n");
+  if ( added )
+    diff_block(d, &none, ob);
+  else
+    diff_block(d, ob, &none);
+  ob->len = 0;
+  ob_free(&none);
+}
+
+/* Unified diff text of old to new in d->ob, returns the number of
+ * blocks that differ.
+ */
+long diff_config (struct dhcpd_conf *old, struct dhcpd_conf *new, const char *filename, struct diff_out *d) {
+  struct outbuf a, b;
+  struct dhcpd_param *pa;
+  struct dhcpd_subnet *sn, *osn;
+  struct dhcpd_host *ho, *oho;
+  memset(&a, 0, sizeof(struct outbuf));
+  memset(&b, 0, sizeof(struct outbuf));
+  ob_init(&a, 0);
+  ob_init(&b, 0);
+  if ( d->ob.size == 0 )
+    ob_init(&d->ob, 0);
+  d->blocks = 0;
+  ob_printf(&d->ob, "--- %s\n+++ %s (to be saved)\n", filename, filename);
+  d->hunk = "globals";
+  if ( ! params_same(&old->globals, &new->globals) ) {
+    for ( pa = old->globals.first; pa != NULL; pa = pa->next )
+      ob_param(&a, "", pa);
+    for ( pa = new->globals.first; pa != NULL; pa = pa->next )
+      ob_param(&b, "", pa);
+    diff_block(d, &a, &b);
+  }
+  for ( sn = new->subnets; sn != NULL; sn = sn->next ) {
+    d->hunk = arena_printf(&scratch, "subnet %s netmask %s", sn->network, sn->netmask);
+    if ( ( osn = subnet_get(old, sn->network) ) == NULL ) {
+      diff_subnet_whole(d, sn, &b, 1);
+      continue;
+    }
+    if ( ! str_same(osn->netmask, sn->netmask) || ! params_same(&osn->params, &sn->params) ) {
+      diff_subnet_head(&a, osn);
+      diff_subnet_head(&b, sn);
+      diff_block(d, &a, &b);
+    }
+    for ( ho = sn->hosts; ho != NULL; ho = ho->next ) {
+      oho = host_get(old, osn, ho->name);
+      if ( oho != NULL && host_same(oho, ho) )
+	continue;
+      if ( oho != NULL )
+	ob_host(&a, oho, "", "    ");
+      ob_host(&b, ho, "", "    ");
+      diff_block(d, &a, &b);
+    }
+    for ( oho = osn->hosts; oho != NULL; oho = oho->next ) {
+      if ( host_get(new, sn, oho->name) != NULL )
+	continue;
+      ob_host(&a, oho, "", "    ");
+      diff_block(d, &a, &b);
+    }
+  }
+  for ( osn = old->subnets; osn != NULL; osn = osn->next ) {
+    if ( subnet_get(new, osn->network) != NULL )
+      continue;
+    d->hunk = arena_printf(&scratch, "subnet %s netmask %s", osn->network, osn->netmask);
+    diff_subnet_whole(d, osn, &a, 0);
+  }
+  d->hunk = NULL;
+  ob_free(&a);
+  ob_free(&b);
+  return d->blocks;
+}
+
+/* Diff of dhcpd.conf on disk to config on stdout, 1 when something
+ * changes and 0 when nothing does, as diff(1).
+ */
+static int print_diff (struct dhcpd_conf *config, const char *filename) {
+  struct dhcpd_conf *old;
+  struct diff_out d;
+  long blocks;
+  memset(&d, 0, sizeof(struct diff_out));
+  old = get_dhcpd_config(filename);
+  blocks = diff_config(old, config, filename, &d);
+  if ( blocks > 0 )
+    fwrite(d.ob.data, 1, d.ob.len, stdout);
+  ob_free(&d.ob);
+  destroy_conf(old);
+  return ( blocks > 0 ) ? 1 : 0;
+}
+
+/* Batch mode, import a CSV of hosts and save without any dialog, or
+ * only print what would change when dry_run.
+ */
+static int batch_import (const char *filename, int dry_run) {
+  struct dhcpd_conf *config;
+  struct check_report cr;
+  long imported, rejected;
+  int rc;
+  config = get_dhcpd_config(DEFCONFIG);
+  if ( ( rejected = import_hosts_csv(config, filename, &imported) ) < 0 ) {
+    fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+    destroy_conf(config);
+    return dry_run ? 2 : EXIT_FAILURE;
+  }
+  /* there is nobody to ask, problems are only reported */
+  memset(&cr, 0, sizeof(struct check_report));
+  if ( imported > 0 && check_config(config, NULL, &cr) > 0 )
+    fprintf(stderr, "%s: %li problems dhcpd would refuse:\n%s", DEFCONFIG, cr.count, cr.text.data);
+  ob_free(&cr.text);
+  if ( dry_run ) {
+    fprintf(stderr, "%li hosts would be imported, %li rows rejected.\n", imported, rejected);
+    rc = print_diff(config, DEFCONFIG);
+    destroy_conf(config);
+    crex_free();
+    file_cache_free();
+    return ( rejected > 0 ) ? 2 : rc;
+  }
+  if ( imported > 0 && save_dhcpd_config(DEFCONFIG, config) != 0 ) {
+    fprintf(stderr, "%s: save failed\n", DEFCONFIG);
+    destroy_conf(config);
+    return EXIT_FAILURE;
+  }
+  printf("%li hosts imported, %li rows rejected.\n", imported, rejected);
+  if ( last_load.model )
+    printf("Loaded: read %.3fs, model cache %.3fs, %i files\n",
+	   last_load.read, last_load.merge, last_load.files);
+  else
+    printf("Loaded: read %.3fs, parse %.3fs, merge %.3fs, %i threads on %i chunks, %i files (%i cached)\n",
+	   last_load.read, last_load.parse, last_load.merge, last_load.threads, last_load.chunks,
+	   last_load.files, last_load.cached);
+  if ( imported > 0 )
+    printf("Saved: backup %.3fs, render %.3fs on %i threads, write %.3fs, fsync %.3fs, rename %.3fs\n",
+	   last_save.backup, last_save.render, last_save.threads, last_save.write, last_save.sync,
+	   last_save.rename);
+  destroy_conf(config);
+  crex_free();
+  file_cache_free();
+  return ( rejected > 0 ) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* Export of the loaded configuration for other tools, one record a
+ * line as JSON Lines or CSV.  Records go through a small buffer that
+ * is written out as it fills, memory stays the same for any size.
+ */
+#define EXPORT_FLUSH  65536
+
+enum export_field {
+  X_TYPE = 0,
+  X_SUBNET,
+  X_NETMASK,
+  X_HOST,
+  X_HARDWARE,
+  X_ADDRESS,
+  X_NAME,
+  X_VALUE,
+  X_COUNT
+};
+
+static const char *export_field[] = {
+  "type", "subnet", "netmask", "host", "hardware", "address", "name", "value",
+  0x00 /* NULL */
+};
+
+struct export_out {
+  struct outbuf ob;
+  int fdes, csv, err;
+};
+
+static void export_flush (struct export_out *xo) {
+  struct iovec iov;
+  iov.iov_base = xo->ob.data;
+  iov.iov_len = xo->ob.len;
+  if ( xo->ob.len > 0 && ! xo->err && write_iov(xo->fdes, &iov, 1) == -1 )
+    xo->err = errno;
+  xo->ob.len = 0;
+}
+
+/* JSON string body, runs of plain chars copied at once. */
+static void ob_json (struct outbuf *ob, const char *s) {
+  const char *run;
+  char esc[8];
+  for ( run = s; *s; s++ ) {
+    if ( *s != '"' && *s != '\\' && (unsigned char) *s >= 0x20 )
+      continue;
+    ob_write(ob, run, s - run);
+    if ( *s == '"' || *s == '\\' )
+      snprintf(esc, sizeof(esc), "\\%c", *s);
+    else
+      snprintf(esc, sizeof(esc), "\\u%04x", (unsigned char) *s);
+    ob_puts(ob, esc);
+    run = s + 1;
+  }
+  ob_write(ob, run, s - run);
+}
+
+/* CSV field, quoted only when it has to. */
+static void ob_csv (struct outbuf *ob, const char *s) {
+  const char *run;
+  if ( strpbrk(s, ",\"\r\n") == NULL ) {
+    ob_puts(ob, s);
+    return;
+  }
+  ob_puts(ob, "\"");
+  for ( run = s; ( s = strchr(s, '"') ) != NULL; run = ++s ) {
+    ob_write(ob, run, s - run + 1);
+    ob_puts(ob, "\"");
+  }
+  ob_puts(ob, run);
+  ob_puts(ob, "\"");
+}
+
+/* One record, fields left NULL are left out. */
+static void export_record (struct export_out *xo, const char **v) {
+  int i, first = 1;
+  if ( xo->csv ) {
+    for ( i = 0; i < X_COUNT; i++ ) {
+      if ( i > 0 )
+	ob_puts(&xo->ob, ",");
+      if ( v[i] != NULL )
+	ob_csv(&xo->ob, v[i]);
+    }
+    ob_puts(&xo->ob, "\n");
   } else {
-    printf("reading %s, failed.\n", filename);
-    free(gs);
+    ob_puts(&xo->ob, "{");
+    for ( i = 0; i < X_COUNT; i++ ) {
+      if ( v[i] == NULL )
+	continue;
+      ob_puts(&xo->ob, first ? "\"" : ",\"");
+      ob_puts(&xo->ob, export_field[i]);
+      ob_puts(&xo->ob, "\":\"");
+      ob_json(&xo->ob, v[i]);
+      ob_puts(&xo->ob, "\"");
+      first = 0;
+    }
+    ob_puts(&xo->ob, "}\n");
+  }
+  if ( xo->ob.len >= EXPORT_FLUSH )
+    export_flush(xo);
+}
+
+/* Statements of a list, '+' joined keywords split back as saved. */
+static void export_params (struct export_out *xo, const char **v, struct dhcpd_params *pl, const char *type) {
+  struct dhcpd_param *pa;
+  char name[256];
+  size_t i;
+  for ( pa = pl->first; pa != NULL && ! xo->err; pa = pa->next ) {
+    if ( param_is_range(pa) ) {
+      v[X_TYPE] = "range";
+      v[X_NAME] = NULL;
+    } else {
+      for ( i = 0; pa->name[i] && i < sizeof(name) - 1; i++ )
+	name[i] = ( pa->name[i] == '+' ) ? ' ' : pa->name[i];
+      name[i] = 0x00; /* NULL */
+      v[X_TYPE] = type;
+      v[X_NAME] = name;
+    }
+    v[X_VALUE] = pa->value;
+    export_record(xo, v);
+  }
+  v[X_NAME] = v[X_VALUE] = NULL;
+}
+
+/* Globals, then each subnet with its statements and hosts, in file
+ * order.  csv selects CSV with a heading instead of JSON Lines.
+ */
+int export_config (struct dhcpd_conf *config, int csv, int fdes) {
+  const char *v[X_COUNT];
+  struct export_out xo;
+  struct dhcpd_subnet *sn;
+  struct dhcpd_host *ho;
+  int i;
+  memset(&xo, 0, sizeof(struct export_out));
+  memset(v, 0, sizeof(v));
+  ob_init(&xo.ob, EXPORT_FLUSH * 2);
+  xo.fdes = fdes;
+  xo.csv = csv;
+  if ( csv ) {
+    for ( i = 0; i < X_COUNT; i++ )
+      ob_printf(&xo.ob, "%s%s", ( i > 0 ) ? "," : "", export_field[i]);
+    ob_puts(&xo.ob, "\n");
+  }
+  export_params(&xo, v, &config->globals, "global");
+  for ( sn = config->subnets; sn != NULL && ! xo.err; sn = sn->next ) {
+    v[X_TYPE] = "subnet";
+    v[X_SUBNET] = sn->network;
+    v[X_NETMASK] = sn->netmask;
+    export_record(&xo, v);
+    v[X_NETMASK] = NULL;
+    export_params(&xo, v, &sn->params, "option");
+    for ( ho = sn->hosts; ho != NULL && ! xo.err; ho = ho->next ) {
+      v[X_TYPE] = "host";
+      v[X_HOST] = ho->name;
+      v[X_HARDWARE] = ho->hardware;
+      v[X_ADDRESS] = ho->address;
+      export_record(&xo, v);
+      v[X_HARDWARE] = v[X_ADDRESS] = NULL;
+      export_params(&xo, v, &ho->params, "option");
+    }
+    v[X_HOST] = NULL;
+  }
+  export_flush(&xo);
+  ob_free(&xo.ob);
+  errno = xo.err;
+  return xo.err ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* Batch mode, what saving filename over dhcpd.conf would change. */
+static int batch_diff (const char *filename) {
+  struct dhcpd_conf *config;
+  int rc;
+  config = get_dhcpd_config(filename);
+  rc = print_diff(config, DEFCONFIG);
+  destroy_conf(config);
+  crex_free();
+  file_cache_free();
+  return rc;
+}
+
+/* Batch mode, export dhcpd.conf to stdout as json or csv. */
+static int batch_export (const char *format) {
+  struct dhcpd_conf *config;
+  int rc;
+  if ( strcmp(format, "json") != 0 && strcmp(format, "csv") != 0 ) {
+    fprintf(stderr, "%s: export format is json or csv\n", program_invocation_short_name);
+    return EXIT_FAILURE;
+  }
+  config = get_dhcpd_config(DEFCONFIG);
+  if ( ( rc = export_config(config, format[0] == 'c', STDOUT_FILENO) ) != EXIT_SUCCESS )
+    fprintf(stderr, "%s: export: %s\n", program_invocation_short_name, strerror(errno));
+  destroy_conf(config);
+  crex_free();
+  file_cache_free();
+  return rc;
+}
+
+/* Show what Save is going to change, nonzero to go back. */
+static int review_changes (const char *title, struct dhcpd_conf *config) {
+  struct dhcpd_conf *old;
+  struct diff_out d;
+  char path[] = "/tmp/dhcpdtui-diff.XXXXXX";
+  long blocks;
+  int fdes;
+  memset(&d, 0, sizeof(struct diff_out));
+  old = get_dhcpd_config(DEFCONFIG);
+  blocks = diff_config(old, config, DEFCONFIG, &d);
+  destroy_conf(old);
+  if ( blocks > 0 && ( fdes = mkstemp(path) ) != -1 ) {
+    if ( write(fdes, d.ob.data, d.ob.len) == (ssize_t) d.ob.len )
+      dialog_textbox(title, path, 22, 72);
     close(fdes);
-    endwin();
-    exit(EXIT_FAILURE);
+    unlink(path);
+  }
+  ob_free(&d.ob);
+  if ( blocks == 0 )
+    return 0;
+  return dialog_yesno(title, arena_printf(&scratch, "\n%li blocks of %s change, save them?\n",
+					  blocks, DEFCONFIG), 22, 72);
+}
+
+/* Changes made to dhcpd.conf or its included files by someone else
+ * while the dialog is open.  A thread blocks on inotify for the
+ * directories of the loaded files and only raises a flag, the dialog
+ * loop checks the files at its next turn.  Those that changed are
+ * loaded again, unchanged included files come from the file cache,
+ * and merged three ways: blocks they changed that were not edited
+ * here are taken, blocks changed on both sides are conflicts and keep
+ * the version edited here.
+ */
+struct watch_file {
+  char *path;
+  int wd;                    /* watch of its directory, shared by its files */
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  struct timespec mtime;
+};
+
+static struct {
+  int fd;                    /* inotify, 0 until started */
+  int changed;               /* set by the thread */
+  struct watch_file *file;
+  int nfiles;
+  struct dhcpd_conf *base;   /* the files as last loaded */
+  long conflicts;            /* since the last merge, until Save shows them */
+  struct outbuf text;        /* one line for each conflict */
+} watch;
+
+static void *watch_worker (void *arg) {
+  char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  ssize_t n;
+  for ( ;; ) {
+    if ( ( n = read(watch.fd, buf, sizeof(buf)) ) > 0 )
+      __atomic_store_n(&watch.changed, 1, __ATOMIC_RELEASE);
+    else if ( n == -1 && errno == EINTR )
+      continue;
+    else
+      return NULL;
+  }
+}
+
+static int watch_has (struct watch_file *file, int nfiles, int wd) {
+  int i;
+  for ( i = 0; i < nfiles; i++ )
+    if ( file[i].wd == wd )
+      return 1;
+  return 0;
+}
+
+/* Take note of the files of base and watch their directories, those
+ * no file is left in any more are not watched.
+ */
+static void watch_files (struct dhcpd_conf *base) {
+  struct watch_file *old = watch.file;
+  struct stat sb;
+  char *dir, *slash;
+  int i, nold = watch.nfiles;
+  watch.nfiles = base->nfiles;
+  watch.file = xmalloc(sizeof(struct watch_file) * ( watch.nfiles + 1 ));
+  for ( i = 0; i < watch.nfiles; i++ ) {
+    memset(&watch.file[i], 0, sizeof(struct watch_file));
+    watch.file[i].path = savestring(base->files[i]->path);
+    if ( stat(watch.file[i].path, &sb) == 0 ) {
+      watch.file[i].dev = sb.st_dev;
+      watch.file[i].ino = sb.st_ino;
+      watch.file[i].size = sb.st_size;
+      watch.file[i].mtime = sb.st_mtim;
+    }
+    /* editors and our own saves replace files, so watch directories */
+    dir = savestring(watch.file[i].path);
+    if ( ( slash = strrchr(dir, '/') ) != NULL )
+      *( ( slash == dir ) ? slash + 1 : slash ) = 0x00; /* NULL */
+    else
+      strcpy(dir, ".");
+    watch.file[i].wd = -1;
+    if ( watch.fd > 0 )
+      watch.file[i].wd = inotify_add_watch(watch.fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE);
+    free(dir);
+  }
+  for ( i = 0; i < nold; i++ ) {
+    if ( old[i].wd >= 0 && ! watch_has(old, i, old[i].wd) && ! watch_has(watch.file, watch.nfiles, old[i].wd) )
+      inotify_rm_watch(watch.fd, old[i].wd);
+    free(old[i].path);
+  }
+  free(old);
+}
+
+/* Forget the conflicts once Save listed them. */
+static void watch_clear (void) {
+  watch.conflicts = 0;
+  ob_free(&watch.text);
+}
+
+static int watch_stale (void) {
+  struct stat sb;
+  int i;
+  for ( i = 0; i < watch.nfiles; i++ ) {
+    if ( stat(watch.file[i].path, &sb) != 0 )
+      continue;
+    if ( sb.st_dev != watch.file[i].dev || sb.st_ino != watch.file[i].ino ||
+	 sb.st_size != watch.file[i].size || sb.st_mtim.tv_sec != watch.file[i].mtime.tv_sec ||
+	 sb.st_mtim.tv_nsec != watch.file[i].mtime.tv_nsec )
+      return 1;
+  }
+  return 0;
+}
+
+/* Start watching what config was loaded from, base is a copy of it
+ * left as it is on disk.
+ */
+void watch_start (const char *filename) {
+  pthread_t thread;
+  watch.base = get_dhcpd_config(filename);
+  if ( ( watch.fd = inotify_init1(IN_CLOEXEC) ) == -1 )
+    watch.fd = 0;
+  watch_files(watch.base);
+  if ( watch.fd > 0 && pthread_create(&thread, NULL, watch_worker, NULL) == 0 )
+    pthread_detach(thread);
+}
+
+/* Replace the statements of dst by a copy of src, files kept. */
+static void params_take (struct dhcpd_conf *config, struct dhcpd_params *dst, struct dhcpd_params *src) {
+  struct dhcpd_param *pa;
+  config->checks_valid = 0;
+  memset(dst, 0, sizeof(struct dhcpd_params));
+  for ( pa = src->first; pa != NULL; pa = pa->next ) {
+    config->file = pa->file;
+    if ( param_is_range(pa) )
+      param_put_range(config, dst, pa->value);
+    else
+      param_put(config, dst, pa->name, pa->value);
   }
-  free(prefix_subnet);
-  free(prefix_host);
-  free(prefix_plus_key);
-  free(gs);
-  close(fdes);
-  return(config);
+  config->file = NULL;
 }
 
-char **manual_fast_menu (int *menusz, ...) {
-  va_list strings;
-  char *vas, **menu;
-  va_start (strings, menusz);
-  *menusz = 0;
-  menu = xmalloc(sizeof(menu));
-  while ( ( vas = va_arg(strings, char *) ) != NULL ) {
-    menu[(*menusz)++] = savestring(vas);
-    menu = xrealloc(menu, sizeof(menu) * ((*menusz) + 1));
+static void host_take (struct dhcpd_conf *config, struct dhcpd_host *ho, struct dhcpd_host *from) {
+  if ( from->hardware == NULL && ho->hardware != NULL ) {
+    if ( ho->has_mac )
+      index_del(&config->by_mac, ho, KEY_MAC);
+    ho->hardware = NULL;
+    ho->has_mac = 0;
   }
-  va_end (strings);
-  return menu;
+  if ( from->address == NULL && ho->address != NULL ) {
+    if ( ho->has_ip )
+      index_del(&config->by_ip, ho, KEY_IP);
+    ho->address = NULL;
+    ho->has_ip = 0;
+  }
+  host_set(config, ho, from->hardware, from->address);
+  params_take(config, &ho->params, &from->params);
 }
 
-int filecopy (const char *fnin, const char *fnout) {
-  int inputFd, outputFd, openFlags;
-  mode_t filePerms;
-  ssize_t numRead;
-  char buf[BUFSIZ];
- 
-  /* Open input and output files */
-  inputFd = open(fnin, O_RDONLY);
-  if (inputFd == -1)
-    return inputFd;
-  openFlags = O_CREAT | O_WRONLY | O_TRUNC;
-  // filePerms = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH; /* rw-rw-rw- */
-  filePerms = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH; /* rw-r--r-- */
-  outputFd = open(fnout, openFlags, filePerms);
-  if (outputFd == -1)
-    return outputFd;
- 
-  /* Transfer data until we encounter end of input or an error */
-  while ((numRead = read(inputFd, buf, BUFSIZ)) > 0)
-    if (write(outputFd, buf, numRead) != numRead)
-      return EXIT_FAILURE;
-  if (numRead == -1)
-    return numRead;
-  if (close(inputFd) == -1)
-    return EXIT_FAILURE;
-  if (close(outputFd) == -1)
-    return EXIT_FAILURE;
- 
-  return EXIT_SUCCESS;
+static void watch_conflict (const char *what, const char *name, struct dhcpd_subnet *sn) {
+  watch.conflicts++;
+  ob_printf(&watch.text, "%s %s%s%s\n", what, name, ( sn != NULL ) ? " in subnet " : "",
+	    ( sn != NULL ) ? sn->network : "");
 }
 
-char **lsbkdir_fast_menu (int *menusz) {
-  DIR *dp;
-  struct dirent *ep;
-  char **menu;
-  *menusz = 0;
-  char *bs;
-  dp = opendir (DEFPATH);
-  if (dp != NULL) {
-    menu = xmalloc(sizeof(menu));
-    while ( (ep = readdir (dp)) != NULL ) {
-      if ( m_rex(ep->d_name, DEFNAME "-[0-9]+-[0-9]", "") ) {
-	menu[(*menusz)++] = savestring(ep->d_name);
-	menu = xrealloc(menu, sizeof(menu) * ((*menusz) + 1));
-	bs = s_rex(ep->d_name, DEFNAME "-", "", "");
-	asprintf(&(menu[(*menusz)++]), "%c%c%c%c/%c%c/%c%c %c%c:%c%c:%c%c",
-		 bs[0], bs[1], bs[2], bs[3], bs[4], bs[5], bs[6],
-		 bs[7], bs[9], bs[10], bs[11], bs[12], bs[13], bs[14]);
-	menu = xrealloc(menu, sizeof(menu) * ((*menusz) + 1));
-      }
+static int subnet_head_same (struct dhcpd_subnet *a, struct dhcpd_subnet *b) {
+  return str_same(a->netmask, b->netmask) && params_same(&a->params, &b->params);
+}
+
+static int subnet_same (struct dhcpd_subnet *a, struct dhcpd_conf *ca, struct dhcpd_subnet *b,
+			struct dhcpd_conf *cb) {
+  struct dhcpd_host *ho, *bho;
+  if ( a->nhosts != b->nhosts || ! subnet_head_same(a, b) )
+    return 0;
+  for ( ho = a->hosts; ho != NULL; ho = ho->next )
+    if ( ( bho = host_get(cb, b, ho->name) ) == NULL || ! host_same(ho, bho) )
+      return 0;
+  return 1;
+}
+
+/* Hosts of subnet tsn of theirs into osn of ours, bsn of base is the
+ * common ancestor or NULL for a subnet new on both sides.
+ */
+static long merge_hosts (struct dhcpd_conf *ours, struct dhcpd_subnet *osn, struct dhcpd_conf *base,
+			 struct dhcpd_subnet *bsn, struct dhcpd_conf *theirs, struct dhcpd_subnet *tsn) {
+  struct dhcpd_host *tho, *bho, *oho;
+  long taken = 0;
+  for ( tho = tsn->hosts; tho != NULL; tho = tho->next ) {
+    bho = ( bsn != NULL ) ? host_get(base, bsn, tho->name) : NULL;
+    if ( bho != NULL && host_same(bho, tho) )
+      continue;
+    oho = host_get(ours, osn, tho->name);
+    if ( oho != NULL && host_same(oho, tho) )
+      continue;
+    if ( bho == NULL && oho == NULL ) {
+      ours->file = tho->file;
+      oho = host_put(ours, osn, tho->name, NULL, NULL);
+      ours->file = NULL;
+      host_take(ours, oho, tho);
+      taken++;
+    } else if ( bho != NULL && oho != NULL && host_same(oho, bho) ) {
+      host_take(ours, oho, tho);
+      taken++;
+    } else {
+      watch_conflict("host", tho->name, tsn);
     }
-    (void) closedir (dp);
-  } else {
-    return NULL;
   }
-  return menu;
+  for ( bho = ( bsn != NULL ) ? bsn->hosts : NULL; bho != NULL; bho = bho->next ) {
+    if ( host_get(theirs, tsn, bho->name) != NULL || ( oho = host_get(ours, osn, bho->name) ) == NULL )
+      continue;
+    if ( host_same(oho, bho) ) {
+      host_delete(ours, osn, bho->name);
+      taken++;
+    } else {
+      watch_conflict("host", bho->name, bsn);
+    }
+  }
+  return taken;
 }
 
-int save_dhcpd_config (const char *filename, struct AArray *config, long int k_lim, char **key) {
-  char **subnet;
-  int fdes, i_key, i_subnet, subnetsz = 0, is_shared_network = 0;
-  FILE *fstream;
-  char *fstrm, *fstrm_temp, *sk, *sv, *fstrm_opts, *suffix, *filename_suffix, *tabs;
-  struct tm *s_suffix;
-  time_t tm_t;
-  tm_t = time(NULL);
-  s_suffix = localtime(&tm_t);
-  suffix = xmalloc(18);
-  if ( strftime(suffix, 17, "-%Y%m%d-%H%M%S", s_suffix) == 0 ) {
-    free(suffix);
-    return EXIT_FAILURE;
-  } else {
-    asprintf(&filename_suffix, "%s%s", filename, suffix);
-    free(suffix);
-    if ( filecopy (filename, filename_suffix) != 0 ) {
-      free(filename_suffix);
-      return EXIT_FAILURE;
+/* Merge what changed from base to theirs into ours, returns the
+ * blocks taken.  Conflicts are counted in watch.
+ */
+static long merge_config (struct dhcpd_conf *ours, struct dhcpd_conf *base, struct dhcpd_conf *theirs) {
+  struct dhcpd_subnet *tsn, *bsn, *osn;
+  long taken = 0;
+  if ( ! params_same(&base->globals, &theirs->globals) && ! params_same(&ours->globals, &theirs->globals) ) {
+    if ( params_same(&ours->globals, &base->globals) ) {
+      params_take(ours, &ours->globals, &theirs->globals);
+      taken++;
+    } else {
+      watch_conflict("global", "statements", NULL);
     }
-    free(filename_suffix);
   }
-  asprintf(&fstrm, "# %s: dhcpd.conf auto generated\n", program_invocation_short_name);
-  subnet = xmalloc(sizeof(subnet));
-  for ( i_key = 0; i_key < k_lim; i_key++ ) {
-    if ( ! m_rex(key[i_key], "/", "" ) ) {
-      if ( m_rex(key[i_key], "^subnet", "" ) ) {
-	subnet[subnetsz++] = savestring(key[i_key]);
-	subnet = xrealloc(subnet, sizeof(subnet) * (subnetsz + 1));
+  for ( tsn = theirs->subnets; tsn != NULL; tsn = tsn->next ) {
+    bsn = subnet_get(base, tsn->network);
+    osn = subnet_get(ours, tsn->network);
+    if ( bsn != NULL && subnet_same(bsn, base, tsn, theirs) )
+      continue;
+    if ( osn == NULL ) {
+      if ( bsn != NULL ) {
+	/* removed here, changed there */
+	watch_conflict("subnet", tsn->network, NULL);
+	continue;
+      }
+      ours->file = tsn->file;
+      osn = subnet_put(ours, tsn->network, tsn->netmask);
+      ours->file = NULL;
+      params_take(ours, &osn->params, &tsn->params);
+      taken++;
+    } else if ( bsn != NULL && ! subnet_head_same(bsn, tsn) && ! subnet_head_same(osn, tsn) ) {
+      if ( subnet_head_same(osn, bsn) ) {
+	osn->netmask = conf_string(ours, tsn->netmask);
+	ours->checks_valid = 0;
+	params_take(ours, &osn->params, &tsn->params);
+	taken++;
       } else {
-	fstrm_temp = fstrm;
-	if ( m_rex(key[i_key], "^shared-network$", "") ) {
-	  /* especific rule just for shared-network reserved word */
-	  is_shared_network = 1;
-	  asprintf(&fstrm, "%s# %s: You have to use dot1q instead shared network.\n%s %s {\n", fstrm_temp, program_invocation_short_name, key[i_key], get_aa(config, key[i_key]));
-	} else
-	if ( m_rex(key[i_key], "^authoritative$", "") ) {
-	  /* especific rule just for authoritative reserved word */
-	  asprintf(&fstrm, "%s%s;\n", fstrm_temp, key[i_key]);
-	} else {
-	  asprintf(&fstrm, "%s%s %s;\n", fstrm_temp, key[i_key], get_aa(config, key[i_key]));
-	}
-	free(fstrm_temp);
+	watch_conflict("subnet", tsn->network, NULL);
       }
+    } else if ( bsn == NULL && ! subnet_head_same(osn, tsn) ) {
+      watch_conflict("subnet", tsn->network, NULL);
     }
+    taken += merge_hosts(ours, osn, base, bsn, theirs, tsn);
+  }
+  for ( bsn = base->subnets; bsn != NULL; bsn = bsn->next ) {
+    if ( subnet_get(theirs, bsn->network) != NULL || ( osn = subnet_get(ours, bsn->network) ) == NULL )
+      continue;
+    if ( subnet_same(osn, ours, bsn, base) && subnet_delete(ours, osn) )
+      taken++;
+    else
+      watch_conflict("subnet", bsn->network, NULL);
+  }
+  return taken;
+}
+
+/* Called by the dialog loop, merges external changes into config
+ * and tells what happened.  Blocking here is fine, the thread only
+ * ever reads inotify.
+ */
+static void watch_poll (const char *title, struct dhcpd_conf *config, const char *filename) {
+  struct dhcpd_conf *theirs;
+  struct stat sb;
+  long taken, conflicts = watch.conflicts;
+  if ( watch.base == NULL || ! __atomic_exchange_n(&watch.changed, 0, __ATOMIC_ACQ_REL) ||
+       ! watch_stale() || stat(filename, &sb) != 0 )
+    return;
+  theirs = get_dhcpd_config(filename);
+  taken = merge_config(config, watch.base, theirs);
+  destroy_conf(watch.base);
+  watch.base = theirs;
+  watch_files(theirs);
+  /* our own writes come back with nothing to take */
+  if ( taken == 0 && watch.conflicts == conflicts )
+    return;
+  dialog_msgbox(title, arena_printf(&scratch,
+				    "\n%s changed on disk.\n\n"
+				    "%li changed blocks were taken, %li were also changed here and "
+				    "keep your version.\n",
+				    filename, taken, watch.conflicts - conflicts), 22, 72, true);
+}
+
+/* Undo and redo.  Every edit is a step holding the state before and
+ * after of the blocks it touches: the global statements, the head of
+ * a subnet or a host.  Strings are never changed in place, so a state
+ * only copies pointers and the list of statements, whatever the size
+ * of the configuration.  Blocks are found again by network and host
+ * name, stepping back or forth puts them as they were.
+ */
+enum undo_kind {
+  UNDO_GLOBALS = 0,
+  UNDO_SUBNET,
+  UNDO_HOST
+};
+
+struct undo_state {
+  int exists;
+  char *netmask, *hardware, *address;
+  char *prev;                  /* host before it in the subnet */
+  struct conf_file *file;
+  struct dhcpd_params params;  /* copy in the undo arena */
+};
+
+struct undo_block {
+  enum undo_kind kind;
+  char *network, *name;
+  struct undo_state before, after;
+  struct undo_block *next, *prev;
+};
+
+struct undo_step {
+  char *what;
+  struct undo_block *blocks, *last;
+  struct undo_step *prev, *next;
+};
+
+static struct {
+  struct arena arena;
+  struct undo_step *first;
+  struct undo_step *done;   /* last step done, NULL when all are undone */
+  struct undo_step *open;   /* being recorded */
+} undo;
+
+static void undo_params (struct dhcpd_params *dst, struct dhcpd_params *src) {
+  struct dhcpd_param *pa, *copy;
+  memset(dst, 0, sizeof(struct dhcpd_params));
+  for ( pa = src->first; pa != NULL; pa = pa->next ) {
+    copy = arena_alloc(&undo.arena, sizeof(struct dhcpd_param));
+    *copy = *pa;
+    copy->next = NULL;
+    if ( dst->last != NULL )
+      dst->last->next = copy;
+    else
+      dst->first = copy;
+    dst->last = copy;
+    dst->count++;
+  }
+}
+
+static void undo_snap (struct dhcpd_conf *config, struct undo_block *ub, struct undo_state *st) {
+  struct dhcpd_subnet *sn;
+  struct dhcpd_host *ho, *prev = NULL;
+  memset(st, 0, sizeof(struct undo_state));
+  if ( ub->kind == UNDO_GLOBALS ) {
+    st->exists = 1;
+    undo_params(&st->params, &config->globals);
+    return;
+  }
+  if ( ( sn = subnet_get(config, ub->network) ) == NULL )
+    return;
+  if ( ub->kind == UNDO_SUBNET ) {
+    st->exists = 1;
+    st->netmask = sn->netmask;
+    st->file = sn->file;
+    undo_params(&st->params, &sn->params);
+    return;
   }
-  if (is_shared_network) {
-    asprintf(&tabs, "  ");
+  if ( ( ho = host_get(config, sn, ub->name) ) == NULL )
+    return;
+  st->exists = 1;
+  st->hardware = ho->hardware;
+  st->address = ho->address;
+  st->file = ho->file;
+  undo_params(&st->params, &ho->params);
+  if ( ho != sn->hosts ) {
+    for ( prev = sn->hosts; prev->next != ho; prev = prev->next );
+    st->prev = prev->name;
+  }
+}
+
+static int undo_same (struct undo_state *a, struct undo_state *b) {
+  return a->exists == b->exists &&
+    ( ! a->exists || ( str_same(a->netmask, b->netmask) && str_same(a->hardware, b->hardware) &&
+		       str_same(a->address, b->address) && params_same(&a->params, &b->params) ) );
+}
+
+/* Move ho, the last host of sn, right after the host named prev. */
+static void host_place (struct dhcpd_subnet *sn, struct dhcpd_host *ho, const char *prev) {
+  struct dhcpd_host *before, *after = NULL;
+  if ( prev != NULL )
+    for ( after = sn->hosts; after != NULL && strcmp(after->name, prev) != 0; after = after->next );
+  if ( ( prev != NULL && after == NULL ) || after == ho || ho->next != NULL || ho == sn->hosts )
+    return;
+  for ( before = sn->hosts; before->next != ho; before = before->next );
+  if ( after == before )
+    return;
+  before->next = NULL;
+  sn->hosts_last = before;
+  if ( after != NULL ) {
+    ho->next = after->next;
+    after->next = ho;
   } else {
-    asprintf(&tabs, "");
-  }
-  for ( i_subnet = 0; i_subnet < subnetsz; i_subnet++ ) {
-    sk = savestring(subnet[i_subnet]);
-    sk = as_rex(sk, "\\+", " ", "g" );
-    sv = savestring(get_aa(config, subnet[i_subnet]));
-    sv = as_rex(sv, "\\+", " ", "g" );
-    fstrm_temp = fstrm;
-    asprintf(&fstrm, "%s%s%s %s {\n", fstrm_temp, tabs, sk, sv);
-    free(fstrm_temp);
-    free(sk);
-    free(sv);
-    subnet[i_subnet] = as_rex(subnet[i_subnet], "\\+", "\\+", "g");
-    subnet[i_subnet] = as_rex(subnet[i_subnet], "\\.", "\\.", "g");
-    subnet[i_subnet] = as_rex(subnet[i_subnet], "^", "^", "");
-    subnet[i_subnet] = as_rex(subnet[i_subnet], "$", "/", "");
-    asprintf(&fstrm_opts, "  %s", tabs);
-    for ( i_key = 0; i_key < k_lim; i_key++ ) {
-      if ( m_rex(key[i_key], subnet[i_subnet], "" ) &&
-	   m_rex(key[i_key], "/hardware\\+ethernet", "" ) ) {
-	sk = s_rex(key[i_key], "/hardware\\+ethernet", "/fixed-address", "");
-	sv = s_rex(key[i_key], "/[^/]+$", "", "");
-	sv = as_rex(sv, "^[^/]+/", "", "");
-	fstrm_temp = fstrm;
-	asprintf(&fstrm,
-		 "%s%s  host %s {\n%s    hardware ethernet %s;\n%s    fixed-address %s;\n%s  }\n",
-		 fstrm_temp, tabs, sv, tabs, get_aa(config, key[i_key]), tabs, get_aa(config, sk), tabs);
-	free(fstrm_temp);
-	free(sk);
-	free(sv);
-      } else if ( m_rex(key[i_key], subnet[i_subnet], "" ) &&
-		  ( m_rex(key[i_key], "/range", "") ||
-		    m_rex(key[i_key], "/option", "") ) ) {
-	sk = s_rex(key[i_key], "^[^/]+/", "", "");
-	sk = as_rex(sk, "[0-9]+$", "", "");
-	sk = as_rex(sk, "\\+", " ", "g");
-	fstrm_temp = fstrm_opts;
-	asprintf(&fstrm_opts, "%s%s %s;\n  %s", fstrm_temp, sk, get_aa(config, key[i_key]), tabs);
-	free(fstrm_temp);
-	free(sk);
-      }
+    ho->next = sn->hosts;
+    sn->hosts = ho;
+  }
+}
+
+static void undo_apply (struct dhcpd_conf *config, struct undo_block *ub, struct undo_state *st) {
+  struct dhcpd_subnet *sn;
+  struct dhcpd_host *ho, from;
+  if ( ub->kind == UNDO_GLOBALS ) {
+    params_take(config, &config->globals, &st->params);
+    return;
+  }
+  sn = subnet_get(config, ub->network);
+  if ( ub->kind == UNDO_SUBNET ) {
+    if ( ! st->exists ) {
+      if ( sn != NULL )
+	subnet_delete(config, sn);
+      return;
     }
-    fstrm_opts = as_rex(fstrm_opts, "  $", "", "");
-    fstrm_temp = fstrm;
-    asprintf(&fstrm, "%s%s}\n", fstrm_temp, fstrm_opts);
-    free(fstrm_temp);
-    free(fstrm_opts);
+    config->file = st->file;
+    sn = subnet_put(config, ub->network, st->netmask);
+    config->file = NULL;
+    params_take(config, &sn->params, &st->params);
+    return;
   }
-  if ( is_shared_network ) {
-    fstrm_temp = fstrm;
-    asprintf(&fstrm, "%s}\n", fstrm_temp);
-    free(fstrm_temp);
+  if ( sn == NULL )
+    return;
+  ho = host_get(config, sn, ub->name);
+  if ( ! st->exists ) {
+    if ( ho != NULL )
+      host_delete(config, sn, ub->name);
+    return;
   }
-#ifdef _DEBUG
-  endwin();
-# ifndef _INFO
-  printf("%s", fstrm);
-# endif
-#endif
-  free_double_pointer(subnet, subnetsz);
-  if ( ( fdes = open(filename, O_WRONLY | O_TRUNC) ) == -1 ) {
-#if defined( _DEBUG ) && !defined( _INFO )
-    printf ("open %s, failed.\n", filename);
-#endif
-    return EXIT_FAILURE;
+  if ( ho == NULL ) {
+    config->file = st->file;
+    ho = host_put(config, sn, ub->name, NULL, NULL);
+    config->file = NULL;
+    host_place(sn, ho, st->prev);
   }
-  if ( ( fstream = fdopen(fdes, "w") ) != NULL ) {
-    fprintf(fstream, "%s", fstrm);
-    fclose(fstream);
+  memset(&from, 0, sizeof(struct dhcpd_host));
+  from.hardware = st->hardware;
+  from.address = st->address;
+  from.params = st->params;
+  host_take(config, ho, &from);
+}
+
+/* Start recording a step, what tells it in the menu. */
+void undo_begin (const char *what) {
+  undo.open = arena_alloc(&undo.arena, sizeof(struct undo_step));
+  memset(undo.open, 0, sizeof(struct undo_step));
+  undo.open->what = arena_strdup(&undo.arena, what);
+}
+
+/* A block the open step is about to change, before it does. */
+static void undo_touch (struct dhcpd_conf *config, enum undo_kind kind, const char *network,
+			const char *name) {
+  struct undo_block *ub;
+  if ( undo.open == NULL )
+    return;
+  for ( ub = undo.open->blocks; ub != NULL; ub = ub->next )
+    if ( ub->kind == kind && str_same(ub->network, network) && str_same(ub->name, name) )
+      return;
+  ub = arena_alloc(&undo.arena, sizeof(struct undo_block));
+  memset(ub, 0, sizeof(struct undo_block));
+  ub->kind = kind;
+  ub->network = ( network != NULL ) ? arena_strdup(&undo.arena, network) : NULL;
+  ub->name = ( name != NULL ) ? arena_strdup(&undo.arena, name) : NULL;
+  undo_snap(config, ub, &ub->before);
+  ub->prev = undo.open->last;
+  if ( undo.open->last != NULL )
+    undo.open->last->next = ub;
+  else
+    undo.open->blocks = ub;
+  undo.open->last = ub;
+}
+
+void undo_globals (struct dhcpd_conf *config) {
+  undo_touch(config, UNDO_GLOBALS, NULL, NULL);
+}
+
+void undo_subnet (struct dhcpd_conf *config, const char *network) {
+  undo_touch(config, UNDO_SUBNET, network, NULL);
+}
+
+void undo_host (struct dhcpd_conf *config, const char *network, const char *name) {
+  undo_touch(config, UNDO_HOST, network, name);
+}
+
+/* Close the open step, it is dropped when nothing changed.  A new
+ * step drops the steps that were undone.
+ */
+void undo_commit (struct dhcpd_conf *config) {
+  struct undo_step *us = undo.open;
+  struct undo_block *ub;
+  int changed = 0;
+  if ( us == NULL )
+    return;
+  undo.open = NULL;
+  for ( ub = us->blocks; ub != NULL; ub = ub->next ) {
+    undo_snap(config, ub, &ub->after);
+    changed |= ! undo_same(&ub->before, &ub->after);
   }
-  free(fstrm);
-  close(fdes);
-#ifdef _DEBUG
-  (void) initscr();
-#endif
-  return EXIT_SUCCESS;
+  if ( ! changed )
+    return;
+  us->prev = undo.done;
+  if ( undo.done != NULL )
+    undo.done->next = us;
+  else
+    undo.first = us;
+  undo.done = us;
+}
+
+/* Step back, blocks in reverse order, or forth.  0 when there is no
+ * step to take.
+ */
+int undo_back (struct dhcpd_conf *config) {
+  struct undo_block *ub;
+  if ( undo.done == NULL )
+    return 0;
+  for ( ub = undo.done->last; ub != NULL; ub = ub->prev )
+    undo_apply(config, ub, &ub->before);
+  undo.done = undo.done->prev;
+  return 1;
 }
 
+int undo_forth (struct dhcpd_conf *config) {
+  struct undo_step *us = ( undo.done != NULL ) ? undo.done->next : undo.first;
+  struct undo_block *ub;
+  if ( us == NULL )
+    return 0;
+  for ( ub = us->blocks; ub != NULL; ub = ub->next )
+    undo_apply(config, ub, &ub->after);
+  undo.done = us;
+  return 1;
+}
+
+/* Menu description of a step. */
+static char *undo_menu (const char *verb, struct undo_step *us) {
+  if ( us == NULL )
+    return "Nothing to change";
+  return arena_printf(&scratch, "%s %s", verb, us->what);
+}
+
+/* Forget every step, when the configuration is replaced. */
+void undo_reset (void) {
+  arena_reset(&undo.arena);
+  undo.first = undo.done = undo.open = NULL;
+}
+
+static void usage (void) {
+  fprintf(stderr, "usage: %s [--stats file] [-j threads] [-i hosts.csv | -e json|csv]\n"
+	  "       %s [-j threads] --diff [-i hosts.csv | dhcpd.conf]\n",
+	  program_invocation_short_name, program_invocation_short_name);
+  exit (EXIT_FAILURE);
+}
+
+#ifndef _BENCH
 int main (int argc, char *argv[]) {
-  char **key, **menu, **fminput;
-  long int k_lim;
-  int idx, fmcount;
-  int menusz, rok;
-  struct AArray *config;
+  char **menu, **fminput;
+#ifdef _DEBUG
+  long int crex_hits, crex_misses;
+#endif
+  int fmcount;
+  int menusz, rok, opt, dry_run = 0;
+  char *import = NULL, *export = NULL;
+  long i;
+  struct dhcpd_conf *config;
+  struct dhcpd_subnet *sn;
+  struct dhcpd_host *ho;
+  struct dhcpd_param *pa;
+  struct check_report cr;
   char *title, *mesg;
-  char *choosenkey, *choosenkey_regcomp, *choosenvalue,
-    *choosenkey_temp, *choosenkey_hw, *choosenkey_ip;
+  char *choosenkey, *choosenvalue, *choosenkey_temp;
+  char mac[18], ip[16], addr[5][16];
+  uint32_t net, mask;
+  static const char *field[] = { "Network", "Subnet-mask", "Broadcast", "Gateway", "Nameserver" };
+  static struct option long_options[] = {
+    { "stats", required_argument, NULL, 's' },
+    { "diff", no_argument, NULL, 'd' },
+    { NULL, 0, NULL, 0 }
+  };
+
+#ifdef _STATS
+  stats.file = getenv("DHCPDTUI_STATS");
+  atexit(stat_dump);
+#endif
+  while ( ( opt = getopt_long(argc, argv, "e:i:j:", long_options, NULL) ) != -1 ) {
+    switch (opt) {
+    case 'e' :
+      export = optarg;
+      break;
+    case 'i' :
+      import = optarg;
+      break;
+    case 'd' :
+      dry_run = 1;
+      break;
+    case 'j' :
+      worker_threads = atoi(optarg);
+      break;
+    case 's' :
+#ifdef _STATS
+      stats.file = optarg;
+#else
+      fprintf(stderr, "%s: --stats needs a build with -D_STATS\n", program_invocation_short_name);
+#endif
+      break;
+    default :
+      usage();
+    }
+  }
+  /* batch modes once every option is known */
+  if ( export != NULL && ( import != NULL || dry_run ) )
+    usage();
+  if ( import != NULL )
+    exit (batch_import(import, dry_run));
+  if ( export != NULL )
+    exit (batch_export(export));
+  if ( dry_run ) {
+    if ( optind >= argc )
+      usage();
+    exit (batch_diff(argv[optind]));
+  }
 
   asprintf(&title, " %s %d.%d.%d (C) %i  %s ",
 	   program_invocation_short_name,
@@ -394,52 +5593,41 @@ int main (int argc, char *argv[]) {
 		"along with this program.  If not, see <http://www.gnu.org/licenses/>.\n",
 		22, 72, true);
   config = get_dhcpd_config(DEFCONFIG);
+  watch_start(DEFCONFIG);
  startagain:
-  key = keys_aa(config, &k_lim);
+#ifdef _STATS
+  stat_dump();
+#endif
+  arena_reset(&scratch);
+  watch_poll(title, config, DEFCONFIG);
   menu = manual_fast_menu(&menusz,
 			  "Subnetworks", "Handle subnetworks",
+			  "Find", "Find host by MAC or IP address",
 			  "Options", "Handle global options",
+			  "Undo", undo_menu("Undo", undo.done),
+			  "Redo", undo_menu("Redo", ( undo.done != NULL ) ? undo.done->next : undo.first),
 			  "Restore", "Restore previous configurations",
 			  "Save", "Save changes and exit",
 			  NULL);
-  asprintf(&mesg, "What to do?");
+  mesg = arena_printf(&scratch, "What to do?");
   if (dialog_vars.input_result) dialog_vars.input_result[0] = '\0';
   rok = dialog_menu(title,
 		    mesg,
 		    22, 72, 17,
 		    menusz / 2, menu);
-  free(mesg);
   if ( rok == 0 ) {
-    if ( m_rex(dialog_vars.input_result, "Subnetworks", "") ) {
+    if ( m_crex(dialog_vars.input_result, "Subnetworks", "") ) {
       /* Subnetworks */
-      free_double_pointer(menu, menusz);
-      menusz = 0;
-      menu = xmalloc(sizeof(menu));
-      for ( idx = 0; idx < k_lim; idx++ ) {
-	if ( ! m_rex(key[idx], "/", "" ) ) {
-	  if ( m_rex(key[idx], "^subnet", "" ) ) {
-	    menu[menusz++] = savestring(key[idx]);
-	    menu = xrealloc(menu, sizeof(menu) * (menusz + 1));
-	    menu[menusz++] = join("/", key[idx], get_aa(config, key[idx]), NULL);
-	    menu[menusz-1] = as_rex(menu[menusz-1], "(subnet|netmask)\\+", "", "g");
-	    menu = xrealloc(menu, sizeof(menu) * (menusz + 1));
-	  }
-	}
-      }
-      menu[menusz++] = savestring("Create subnet");
-      menu = xrealloc(menu, sizeof(menu) * (menusz + 1));
-      menu[menusz++] = savestring("Create a new subnetwork");
-      menu = xrealloc(menu, sizeof(menu) * (menusz + 1));
+      menu = subnet_fast_menu(&menusz, config);
       if (dialog_vars.input_result) dialog_vars.input_result[0] = '\0';
-      rok = dialog_menu(title,
-			"Choose subnetwork:",
-			22, 72, 17,
-			menusz / 2, menu);
+      rok = filter_dialog_menu(title,
+			       "Choose subnetwork:",
+			       22, 72, 17,
+			       menusz / 2, menu);
       if ( rok == 0 ) {
-	asprintf(&choosenkey, "%s", dialog_vars.input_result);
-	if ( m_rex(choosenkey, "^Create subnet", "") ) {
+	choosenkey = arena_printf(&scratch, "%s", dialog_vars.input_result);
+	if ( m_crex(choosenkey, "^Create subnet", "") ) {
 	  /* Create new subnetwork */
-	  free_double_pointer(menu, menusz);
 	  menu = manual_fast_menu(&menusz,
 				  "Network     :", "1", "1", "", "1", "15", "15", "0",
 				  "Subnet-mask :", "2", "1", "", "2", "15", "15", "0",
@@ -447,55 +5635,47 @@ int main (int argc, char *argv[]) {
 				  "Gateway     :", "4", "1", "", "4", "15", "15", "0",
 				  "Nameserver  :", "5", "1", "", "5", "15", "15", "0",
 				  NULL);
-	  asprintf(&mesg, "Subnetwork values:");
+	  mesg = arena_printf(&scratch, "Subnetwork values:");
 	  if (dialog_vars.input_result) dialog_vars.input_result[0] = '\0';
 	  rok = dialog_form(title,
 			    mesg,
 			    22, 72, 14,
 			    menusz / 8, menu);
-	  free(mesg);
 	  if ( rok == 0 ) {
 	    fminput = split("\n", "", dialog_vars.input_result, &fmcount);
-	    fminput[0] = as_rex(fminput[0], "^ +| +$", "", "g");
-	    fminput[0] = as_rex(fminput[0], "[^0-9]+", ".", "g");
-	    fminput[1] = as_rex(fminput[1], "^ +| +$", "", "g");
-	    fminput[1] = as_rex(fminput[1], "[^0-9]+", ".", "g");
-	    fminput[2] = as_rex(fminput[2], "^ +| +$", "", "g");
-	    fminput[2] = as_rex(fminput[2], "[^0-9]+", ".", "g");
-	    fminput[3] = as_rex(fminput[3], "^ +| +$", "", "g");
-	    fminput[3] = as_rex(fminput[3], "[^0-9]+", ".", "g");
-	    fminput[4] = as_rex(fminput[4], "^ +| +$", "", "g");
-	    fminput[4] = as_rex(fminput[4], "[^0-9]+", ".", "g");
-	    asprintf(&choosenkey_temp, "subnet+%s", fminput[0]);
-	    asprintf(&choosenvalue, "netmask+%s", fminput[1]);
-	    put_aa(config, choosenkey_temp, choosenvalue);
-	    free(choosenkey_temp);
-	    free(choosenvalue);
-	    asprintf(&choosenkey_temp, "subnet+%s/option+routers", fminput[0]);
-	    asprintf(&choosenvalue, "%s", fminput[3]);
-	    put_aa(config, choosenkey_temp, choosenvalue);
-	    free(choosenkey_temp);
-	    free(choosenvalue);
-	    asprintf(&choosenkey_temp, "subnet+%s/option+subnet-mask", fminput[0]);
-	    asprintf(&choosenvalue, "%s", fminput[1]);
-	    put_aa(config, choosenkey_temp, choosenvalue);
-	    free(choosenkey_temp);
-	    free(choosenvalue);
-	    asprintf(&choosenkey_temp, "subnet+%s/option+broadcast-address", fminput[0]);
-	    asprintf(&choosenvalue, "%s", fminput[2]);
-	    put_aa(config, choosenkey_temp, choosenvalue);
-	    free(choosenkey_temp);
-	    free(choosenvalue);
-	    asprintf(&choosenkey_temp, "subnet+%s/option+domain-name-servers", fminput[0]);
-	    asprintf(&choosenvalue, "%s", fminput[4]);
-	    put_aa(config, choosenkey_temp, choosenvalue);
-	    free(choosenkey_temp);
-	    free(choosenvalue);
+	    clean_ip(fminput[0]);
+	    clean_ip(fminput[1]);
+	    clean_ip(fminput[2]);
+	    clean_ip(fminput[3]);
+	    clean_ip(fminput[4]);
+	    /* network and mask are a must, the rest when given */
+	    for ( i = 0; i < 5; i++ ) {
+	      addr[i][0] = 0x00; /* NULL */
+	      if ( ( i < 2 || *fminput[i] != 0x00 ) && form_ip(title, field[i], fminput[i], addr[i]) == NULL )
+		break;
+	    }
+	    if ( i == 5 && ip_aton(addr[0], &net) && ip_aton(addr[1], &mask) &&
+		 ( ( ( ~mask & ( ~mask + 1 ) ) != 0 ) || ( net & ~mask ) != 0 ) ) {
+	      dialog_msgbox(title, arena_printf(&scratch, "\nNetwork %s with subnet-mask %s is not a subnet.\n",
+						addr[0], addr[1]), 22, 72, true);
+	      i = 0;
+	    }
+	    if ( i == 5 ) {
+	      undo_begin(arena_printf(&scratch, "subnet %s", addr[0]));
+	      undo_subnet(config, addr[0]);
+	      sn = subnet_put(config, addr[0], addr[1]);
+	      if ( addr[3][0] != 0x00 )
+		param_put(config, &sn->params, "option+routers", addr[3]);
+	      param_put(config, &sn->params, "option+subnet-mask", addr[1]);
+	      if ( addr[2][0] != 0x00 )
+		param_put(config, &sn->params, "option+broadcast-address", addr[2]);
+	      if ( addr[4][0] != 0x00 )
+		param_put(config, &sn->params, "option+domain-name-servers", addr[4]);
+	      undo_commit(config);
+	      check_warn(title, config, sn);
+	    }
 	    free_double_pointer(fminput, fmcount);
 	  }
-	  free(choosenkey);
-	  free_double_pointer(menu, menusz);
-	  free(key);
 	  goto startagain;
 	}
 #ifdef _DEBUG
@@ -506,22 +5686,19 @@ int main (int argc, char *argv[]) {
 # endif
 	(void) initscr();
 #endif
-	free_double_pointer(menu, menusz);
+	sn = subnet_get(config, choosenkey + strlen("subnet+"));
 	menu = manual_fast_menu(&menusz,
 				"option", "Subnetwork options",
 				"range", "Automatic subnetwork DHCP Range",
 				"host", "Subnetwork hosts",
 				NULL);
-	asprintf(&mesg, "What to handle in %s?", dialog_vars.input_result);
+	mesg = arena_printf(&scratch, "What to handle in %s?", dialog_vars.input_result);
 	if (dialog_vars.input_result) dialog_vars.input_result[0] = '\0';
 	rok = dialog_menu(title,
 			  mesg,
 			  22, 72, 17,
 			  menusz / 2, menu);
-	free(mesg);
-	if ( rok == 0 ) {
-	  asprintf(&choosenkey, "%s/%s", choosenkey, dialog_vars.input_result);
-	  choosenkey = as_rex(choosenkey, "/host$", "/", "");
+	if ( rok == 0 && sn != NULL ) {
 #ifdef _DEBUG
 	  endwin();
 	  printf("%s", dialog_vars.input_result);
@@ -530,21 +5707,19 @@ int main (int argc, char *argv[]) {
 # endif
 	  (void) initscr();
 #endif
-	  if ( m_rex(choosenkey, "/$", "") ) {
+	  if ( m_crex(dialog_vars.input_result, "^host$", "") ) {
 	    /* Hosts */
-	    free_double_pointer(menu, menusz);
 	    menu = manual_fast_menu(&menusz,
 				    "Create", "Create a new host",
 				    "Remove", "Remove host",
 				    "Edit", "Modify host's values",
 				    NULL);
-	    asprintf(&mesg, "What do you wanna do with hosts?");
+	    mesg = arena_printf(&scratch, "What do you wanna do with hosts?");
 	    if (dialog_vars.input_result) dialog_vars.input_result[0] = '\0';
 	    rok = dialog_menu(title,
 			      mesg,
 			      22, 72, 17,
 			      menusz / 2, menu);
-	    free(mesg);
 	    if ( rok == 0 ) {
 #ifdef _DEBUG
 	      endwin();
@@ -557,26 +5732,22 @@ int main (int argc, char *argv[]) {
 	      switch (dialog_vars.input_result[0]) {
 	      case 'C' :
 		/* Create new entry */
-		free_double_pointer(menu, menusz);
 		menu = manual_fast_menu(&menusz,
 					"Hostname    :", "1", "1", "", "1", "15", "32", "0",
 					"MAC Address :", "2", "1", "", "2", "15", "17", "0",
 					"IP Address  :", "3", "1", "", "3", "15", "15", "0",
 					NULL);
-		asprintf(&mesg, "Just alfanumeric and dash allowed by Hostname, MAC address colon separated:");
+		mesg = arena_printf(&scratch, "Just alfanumeric and dash allowed by Hostname, MAC address colon separated:");
 		if (dialog_vars.input_result) dialog_vars.input_result[0] = '\0';
 		rok = dialog_form(title,
 				  mesg,
 				  22, 72, 14,
 				  menusz / 8, menu);
-		free(mesg);
 		if ( rok == 0 ) {
 		  fminput = split("\n", "", dialog_vars.input_result, &fmcount);
-		  fminput[0] = as_rex(fminput[0], "[^A-Za-z0-9-]", "", "g");
-		  fminput[1] = as_rex(fminput[1], "[\\.-]+", ":", "g");
-		  fminput[1] = as_rex(fminput[1], "[^A-Fa-f0-9:]", "", "g");
-		  fminput[2] = as_rex(fminput[2], "^ +| +$", "", "g");
-		  fminput[2] = as_rex(fminput[2], "[^0-9]+", ".", "g");
+		  clean_hostname(fminput[0]);
+		  clean_mac(fminput[1]);
+		  clean_ip(fminput[2]);
 #ifdef _DEBUG
 		  endwin();
 		  (fmcount == 3 ) ? printf("%s, %s, %s", fminput[0], fminput[1], fminput[2]) : printf("%i", fmcount);
@@ -585,12 +5756,14 @@ int main (int argc, char *argv[]) {
 # endif
 		  (void) initscr();
 #endif
-		  choosenkey_temp = join("", choosenkey, fminput[0], "/hardware+ethernet", NULL);
-		  put_aa(config, choosenkey_temp, fminput[1]);
-		  free(choosenkey_temp);
-		  choosenkey_temp = join("", choosenkey, fminput[0], "/fixed-address", NULL);
-		  put_aa(config, choosenkey_temp, fminput[2]);
-		  free(choosenkey_temp);
+		  if ( form_mac(title, fminput[1], mac) != NULL && form_ip(title, "IP address", fminput[2], ip) != NULL &&
+		       ! host_conflict(title, config, host_get(config, sn, fminput[0]), mac, ip) ) {
+		    undo_begin(arena_printf(&scratch, "host %s", fminput[0]));
+		    undo_host(config, sn->network, fminput[0]);
+		    host_put(config, sn, fminput[0], mac, ip);
+		    undo_commit(config);
+		    check_warn(title, config, sn);
+		  }
 		  free_double_pointer(fminput, fmcount);
 #ifdef _DEBUG
 		} else {
@@ -602,161 +5775,42 @@ int main (int argc, char *argv[]) {
 		  (void) initscr();
 #endif
 		}
-		free(choosenkey);
-		free_double_pointer(menu, menusz);
-		free(key);
 		goto startagain;
 		break;
 	      case 'R' :
-		/* Remove entry */
-		free_double_pointer(menu, menusz);
-		menusz = 0;
-		menu = xmalloc(sizeof(menu));
-		choosenkey_regcomp = s_rex(choosenkey, "\\+", "\\+", "g");
-		choosenkey_regcomp = as_rex(choosenkey_regcomp, "\\.", "\\.", "g");
-#ifdef _DEBUG
-		endwin();
-		printf("[%li]{%s}", k_lim, choosenkey_regcomp);
-#endif
-		for ( idx = 0; idx < k_lim; idx++ ) {
-		  if ( m_rex(key[idx], choosenkey_regcomp, "" ) &&
-		       m_rex(key[idx], "/hardware\\+ethernet", "" ) ) {
-		    /* a little random problem here with allocation? */
-		    menu[menusz++] = savestring(key[idx]);
-		    menu[menusz-1] = as_rex(menu[menusz-1], choosenkey_regcomp, "", "");
-		    menu[menusz-1] = as_rex(menu[menusz-1], "/hardware\\+ethernet", "", "");
-		    menu = xrealloc(menu, sizeof(menu) * (menusz + 1));
-		    choosenkey_temp = savestring(key[idx]);
-		    choosenkey_temp = as_rex(choosenkey_temp, "/hardware\\+ethernet", "/fixed-address", "");
-		    menu[menusz++] = join(" ", get_aa(config, key[idx]), get_aa(config, choosenkey_temp), NULL);
-		    free(choosenkey_temp);
-		    menu = xrealloc(menu, sizeof(menu) * (menusz + 1));
-#if defined( _DEBUG ) && !defined( _INFO )
-		    printf("\n%s=%s", menu[menusz-2], menu[menusz-1]);
-#endif
-		  }
-		}
-		free(choosenkey_regcomp);
-#ifdef _DEBUG
-# ifndef _INFO
-		printf("\n\nPress any key..."); getchar();
-# endif
-		(void) initscr();
-#endif
-		asprintf(&mesg, "Choose one host of %sto remove:", choosenkey);
-		mesg = as_rex(mesg, "[+/]", " ", "g");
-		if (dialog_vars.input_result) dialog_vars.input_result[0] = '\0';
-		rok = dialog_menu(title,
-				  mesg,
-				  22, 72, 17,
-				  menusz / 2, menu);
-		free(mesg);
-		if ( rok == 0 ) {
-		  choosenkey_temp = join("", choosenkey, dialog_vars.input_result, "/hardware+ethernet", NULL);
-		  delete_aa(config, choosenkey_temp);
-		  free(choosenkey_temp);
-		  choosenkey_temp = join("", choosenkey, dialog_vars.input_result, "/fixed-address", NULL);
-		  delete_aa(config, choosenkey_temp);
-		  free(choosenkey_temp);
-#ifdef _DEBUG
-		} else {
-		  endwin();
-		  printf("Canceled.");
-# ifndef _INFO
-		  printf("\n\nPress any key..."); getchar();
-# endif
-		  (void) initscr();
-#endif
-		}
-		free(choosenkey);
-		free_double_pointer(menu, menusz);
-		free(key);
-		goto startagain;
-		break;
 	      case 'E' :
-		/* Entry edit */
-		free_double_pointer(menu, menusz);
-		menusz = 0;
-		menu = xmalloc(sizeof(menu));
-		choosenkey_regcomp = s_rex(choosenkey, "\\+", "\\+", "g");
-		choosenkey_regcomp = as_rex(choosenkey_regcomp, "\\.", "\\.", "g");
+		/* Remove or edit entry, both choose a host first */
+		choosenvalue = arena_strdup(&scratch, dialog_vars.input_result);
+		menu = host_fast_menu(&menusz, sn);
 #ifdef _DEBUG
 		endwin();
-		printf("[%li]{%s}", k_lim, choosenkey_regcomp);
-#endif
-		for ( idx = 0; idx < k_lim; idx++ ) {
-		  if ( m_rex(key[idx], choosenkey_regcomp, "" ) &&
-		       m_rex(key[idx], "/hardware\\+ethernet", "" ) ) {
-		    /* a little random problem here with allocation? */
-		    menu[menusz++] = savestring(key[idx]);
-		    menu[menusz-1] = as_rex(menu[menusz-1], choosenkey_regcomp, "", "");
-		    menu[menusz-1] = as_rex(menu[menusz-1], "/hardware\\+ethernet", "", "");
-		    menu = xrealloc(menu, sizeof(menu) * (menusz + 1));
-		    choosenkey_temp = savestring(key[idx]);
-		    choosenkey_temp = as_rex(choosenkey_temp, "/hardware\\+ethernet", "/fixed-address", "");
-		    menu[menusz++] = join(" ", get_aa(config, key[idx]), get_aa(config, choosenkey_temp), NULL);
-		    free(choosenkey_temp);
-		    menu = xrealloc(menu, sizeof(menu) * (menusz + 1));
-#if defined( _DEBUG ) && !defined( _INFO )
-		    printf("\n%s=%s", menu[menusz-2], menu[menusz-1]);
-#endif
-		  }
-		}
-		free(choosenkey_regcomp);
-#ifdef _DEBUG
+		printf("[%li]{%s}", sn->nhosts, sn->network);
 # ifndef _INFO
+		for ( i = 0; i < menusz; i += 2 )
+		  printf("\n%s=%s", menu[i], menu[i+1]);
 		printf("\n\nPress any key..."); getchar();
 # endif
 		(void) initscr();
 #endif
-		asprintf(&mesg, "Choose one host of %sto change entry:", choosenkey);
-		mesg = as_rex(mesg, "[+/]", " ", "g");
+		if ( choosenvalue[0] == 'R' )
+		  mesg = arena_printf(&scratch, "Choose one host of subnet %s to remove:", sn->network);
+		else
+		  mesg = arena_printf(&scratch, "Choose one host of subnet %s to change entry:", sn->network);
 		if (dialog_vars.input_result) dialog_vars.input_result[0] = '\0';
-		rok = dialog_menu(title,
-				  mesg,
-				  22, 72, 17,
-				  menusz / 2, menu);
-		free(mesg);
-		if ( rok == 0 ) {
-		  free_double_pointer(menu, menusz);
-		  choosenkey_hw = join("", choosenkey, dialog_vars.input_result, "/hardware+ethernet", NULL);
-		  choosenkey_ip = join("", choosenkey, dialog_vars.input_result, "/fixed-address", NULL);
-		  menu = manual_fast_menu(&menusz,
-					  "MAC Address :", "1", "1", get_aa(config, choosenkey_hw), "1", "15", "17", "0",
-					  "IP Address  :", "2", "1", get_aa(config, choosenkey_ip), "2", "15", "15", "0",
-					  NULL);
-		  asprintf(&mesg, "%s selected:", dialog_vars.input_result);
-		  if (dialog_vars.input_result) dialog_vars.input_result[0] = '\0';
-		  rok = dialog_form(title,
-				    mesg,
-				    22, 72, 14,
-				    menusz / 8, menu);
-		  free(mesg);
-		  if ( rok == 0 ) {
-		    fminput = split("\n", "", dialog_vars.input_result, &fmcount);
-		    fminput[0] = as_rex(fminput[0], "[\\.-]+", ":", "g");
-		    fminput[0] = as_rex(fminput[0], "[^A-Fa-f0-9:]", "", "g");
-		    fminput[1] = as_rex(fminput[1], "^ +| +$", "", "g");
-		    fminput[1] = as_rex(fminput[1], "[^0-9]+", ".", "g");
-		    put_aa(config, choosenkey_hw, fminput[0]);
-		    put_aa(config, choosenkey_ip, fminput[1]);
-		    free_double_pointer(fminput, fmcount);
-#ifdef _DEBUG
-		  } else {
-		    endwin();
-		    printf("Canceled.");
-# ifndef _INFO
-		    printf("\n\nPress any key..."); getchar();
-# endif
-		    (void) initscr();
-#endif
-		  }
-		  free(choosenkey);
-		  free(choosenkey_hw);
-		  free(choosenkey_ip);
-		  free_double_pointer(menu, menusz);
-		  free(key);
-		  goto startagain;
+		rok = filter_dialog_menu(title,
+					 mesg,
+					 22, 72, 17,
+					 menusz / 2, menu);
+		if ( rok == 0 && choosenvalue[0] == 'R' ) {
+		  undo_begin(arena_printf(&scratch, "removal of host %s", dialog_vars.input_result));
+		  undo_host(config, sn->network, dialog_vars.input_result);
+		  host_delete(config, sn, dialog_vars.input_result);
+		  undo_commit(config);
+		} else if ( rok == 0 && ( ho = host_get(config, sn, dialog_vars.input_result) ) != NULL ) {
+		  undo_begin(arena_printf(&scratch, "host %s", ho->name));
+		  undo_host(config, sn->network, ho->name);
+		  edit_host(title, config, ho);
+		  undo_commit(config);
 #ifdef _DEBUG
 		} else {
 		  endwin();
@@ -767,14 +5821,10 @@ int main (int argc, char *argv[]) {
 		  (void) initscr();
 #endif
 		}
-		free(choosenkey);
-		free_double_pointer(menu, menusz);
-		free(key);
 		goto startagain;
 		break;
 	      }
 	    } else {
-	      free(choosenkey);
 #ifdef _DEBUG
 	      endwin();
 	      printf("Canceled.");
@@ -783,63 +5833,51 @@ int main (int argc, char *argv[]) {
 # endif
 	      (void) initscr();
 #endif
-	      free_double_pointer(menu, menusz);
-	      free(key);
-	      goto startagain;
 	    }
-	  } else if ( m_rex(choosenkey, "/option$", "" ) ) {
+	    goto startagain;
+	  } else if ( m_crex(dialog_vars.input_result, "^option$", "" ) ) {
 	    /* Subnet options */
-	    free_double_pointer(menu, menusz);
 	    menusz = 0;
-	    menu = xmalloc(sizeof(menu));
-	    choosenkey_regcomp = s_rex(choosenkey, "\\+", "\\+", "g");
-	    choosenkey_regcomp = as_rex(choosenkey_regcomp, "\\.", "\\.", "g");
+	    menu = arena_alloc(&scratch, sizeof(char *) * (2 * sn->params.count + 1));
 #ifdef _DEBUG
 	    endwin();
-	    printf("[%li]{%s}", k_lim, choosenkey_regcomp);
+	    printf("[%li]{%s}", sn->params.count, sn->network);
 #endif
-	    for ( idx = 0; idx < k_lim; idx++ ) {
-	      if ( m_rex(key[idx], choosenkey_regcomp, "" ) ) {
-		/* a little random problem here with allocation? */
-		menu[menusz++] = savestring(key[idx]);
-		menu[menusz-1] = as_rex(menu[menusz-1], ".*\\+", "", "g");
-		menu = xrealloc(menu, sizeof(menu) * (menusz + 1));
-		menu[menusz++] = savestring(get_aa(config, key[idx]));
-		menu = xrealloc(menu, sizeof(menu) * (menusz + 1));
+	    for ( pa = sn->params.first; pa != NULL; pa = pa->next ) {
+	      if ( param_is_option(pa) ) {
+		menu[menusz++] = arena_strdup(&scratch, pa->name + strlen("option+"));
+		menu[menusz++] = arena_strdup(&scratch, pa->value);
 #if defined( _DEBUG ) && !defined( _INFO )
 		printf("\n%s=%s", menu[menusz-2], menu[menusz-1]);
 #endif
 	      }
 	    }
-	    free(choosenkey_regcomp);
 #ifdef _DEBUG
 # ifndef _INFO
 	    printf("\n\nPress any key..."); getchar();
 # endif
 	    (void) initscr();
 #endif
-	    asprintf(&mesg, "Choose %s:", choosenkey);
-	    mesg = as_rex(mesg, "[+/]", " ", "g");
+	    mesg = arena_printf(&scratch, "Choose subnet %s option:", sn->network);
 	    if (dialog_vars.input_result) dialog_vars.input_result[0] = '\0';
 	    rok = dialog_menu(title,
 			      mesg,
 			      22, 72, 17,
 			      menusz / 2, menu);
-	    free(mesg);
 	    if ( rok == 0 ) {
-	      asprintf(&choosenkey_temp, "%s+%s", choosenkey, dialog_vars.input_result);
-	      free(choosenkey);
-	      choosenkey = savestring(choosenkey_temp);
-	      free(choosenkey_temp);
-	      choosenvalue = savestring(get_aa(config, choosenkey));
-	      asprintf(&mesg, "%s selected:", choosenkey);
+	      choosenkey_temp = arena_printf(&scratch, "option+%s", dialog_vars.input_result);
+	      pa = param_get(&sn->params, choosenkey_temp);
+	      choosenvalue = arena_strdup(&scratch, ( pa != NULL ) ? pa->value : "");
+	      mesg = arena_printf(&scratch, "subnet+%s/%s selected:", sn->network, choosenkey_temp);
 	      rok = dialog_inputbox(title,
 				    mesg,
 				    22, 72,
 				    choosenvalue, 0);
-	      free(mesg);
 	      if ( rok == 0 ) {
-		put_aa(config, choosenkey, dialog_vars.input_result);
+		undo_begin(arena_printf(&scratch, "%s of subnet %s", choosenkey_temp + strlen("option+"), sn->network));
+		undo_subnet(config, sn->network);
+		param_put(config, &sn->params, choosenkey_temp, dialog_vars.input_result);
+		undo_commit(config);
 #ifdef _DEBUG
 	      } else {
 		endwin();
@@ -850,14 +5888,8 @@ int main (int argc, char *argv[]) {
 		(void) initscr();
 #endif
 	      }
-	      free(choosenkey);
-	      free(choosenvalue);
-	      free_double_pointer(menu, menusz);
-	      free(key);
-	      goto startagain;
-	    } else {
-	      free(choosenkey);
 #ifdef _DEBUG
+	    } else {
 	      endwin();
 	      printf("Canceled.");
 # ifndef _INFO
@@ -865,86 +5897,61 @@ int main (int argc, char *argv[]) {
 # endif
 	      (void) initscr();
 #endif
-	      free_double_pointer(menu, menusz);
-	      free(key);
-	      goto startagain;
 	    }
-	  } else if ( m_rex(choosenkey, "/range$", "") ) {
+	    goto startagain;
+	  } else if ( m_crex(dialog_vars.input_result, "^range$", "") ) {
 	    /* Automatic subnet range */
-	    free_double_pointer(menu, menusz);
 	    menusz = 0;
-	    menu = xmalloc(sizeof(menu));
-	    choosenkey_regcomp = s_rex(choosenkey, "\\+", "\\+", "g");
-	    choosenkey_regcomp = as_rex(choosenkey_regcomp, "\\.", "\\.", "g");
+	    menu = arena_alloc(&scratch, sizeof(char *) * (2 * sn->params.count + 1));
 #ifdef _DEBUG
 	    endwin();
-	    printf("[%li]{%s}", k_lim, choosenkey_regcomp);
+	    printf("[%li]{%s}", sn->params.count, sn->network);
 #endif
-	    for ( idx = 0; idx < k_lim; idx++ ) {
-	      if ( m_rex(key[idx], choosenkey_regcomp, "" ) ) {
-		menu[menusz++] = savestring(key[idx]);
-		menu = xrealloc(menu, sizeof(menu) * (menusz + 1));
-		menu[menusz++] = savestring(get_aa(config, key[idx]));
-		menu = xrealloc(menu, sizeof(menu) * (menusz + 1));
+	    for ( pa = sn->params.first; pa != NULL; pa = pa->next ) {
+	      if ( param_is_range(pa) ) {
+		menu[menusz++] = arena_printf(&scratch, "subnet+%s/%s", sn->network, pa->name);
+		menu[menusz++] = arena_strdup(&scratch, pa->value);
 #if defined( _DEBUG ) && !defined( _INFO )
 		printf("\n%s=%s", menu[menusz-2], menu[menusz-1]);
 #endif
 	      }
 	    }
-	    free(choosenkey_regcomp);
 #ifdef _DEBUG
 # ifndef _INFO
 	    printf("\n\nPress any key..."); getchar();
 # endif
 	    (void) initscr();
 #endif
-	    rok = 0;
-	    //free(choosenkey);
+	    pa = NULL;
 	    if ( menusz / 2 > 1 ) {
-	      free(choosenkey);
-	      asprintf(&mesg, "IP range, choose one:");
+	      mesg = arena_printf(&scratch, "IP range, choose one:");
 	      if (dialog_vars.input_result) dialog_vars.input_result[0] = '\0';
 	      rok = dialog_menu(title,
 				mesg,
 				22, 72, 17,
 				menusz / 2, menu);
-	      free(mesg);
-	      if ( rok == 0 ) {
-		choosenkey = savestring(dialog_vars.input_result);
-		choosenvalue = savestring(get_aa(config, choosenkey));
-	      } else {
-#ifdef _DEBUG
-		endwin();
-		printf("Canceled.");
-# ifndef _INFO
-		printf("\n\nPress any key..."); getchar();
-# endif
-		(void) initscr();
-#endif
-		free_double_pointer(menu, menusz);
-		free(key);
-		goto startagain;
+	      if ( rok == 0 && strchr(dialog_vars.input_result, '/') != NULL ) {
+		pa = param_get(&sn->params, strchr(dialog_vars.input_result, '/') + 1);
 	      }
-	    }
-	    if ( menusz / 2 == 1 ) {
-	      free(choosenkey);
-	      choosenkey = savestring(menu[menusz-2]);
-	      choosenvalue = savestring(menu[menusz-1]);
+	    } else if ( menusz / 2 == 1 ) {
+	      pa = param_get(&sn->params, strchr(menu[0], '/') + 1);
 	    }
 	    if ( menusz / 2 < 1 ) {
-	      //free(choosenkey);
-	      /* selection error, automatic cancel (rok = 1;) */
-	      choosenvalue = s_rex(choosenkey, "subnet\\+", "", "");
-	      choosenvalue = as_rex(choosenvalue, "\\.[^\\.]+$", ".", "");
-	      asprintf(&mesg, "IP range, first IP and last IP blankspace separated:");
+	      /* no range yet, suggest the network prefix */
+	      choosenvalue = arena_strdup(&scratch, sn->network);
+	      if ( strrchr(choosenvalue, '.') != NULL )
+		strrchr(choosenvalue, '.')[1] = 0x00; /* NULL */
+	      mesg = arena_printf(&scratch, "IP range, first IP and last IP blankspace separated:");
 	      rok = dialog_inputbox(title,
 				    mesg,
 				    22, 72,
 				    choosenvalue, 0);
-	      free(mesg);
 	      if ( rok == 0 ) {
-		choosenkey = as_rex(choosenkey, "$", "0", "");
-		put_aa(config, choosenkey, dialog_vars.input_result);
+		undo_begin(arena_printf(&scratch, "range of subnet %s", sn->network));
+		undo_subnet(config, sn->network);
+		param_put_range(config, &sn->params, dialog_vars.input_result);
+		undo_commit(config);
+		check_warn(title, config, sn);
 #ifdef _DEBUG
 	      } else {
 		endwin();
@@ -955,21 +5962,19 @@ int main (int argc, char *argv[]) {
 		(void) initscr();
 #endif
 	      }
-	      free(choosenkey);
-	      free(choosenvalue);
-	      free_double_pointer(menu, menusz);
-	      free(key);
-	      goto startagain;
-	    }
-	    if ( rok == 0 ) {
-	      asprintf(&mesg, "IP range, first IP and last IP blankspace separated:");
+	    } else if ( pa != NULL ) {
+	      choosenvalue = arena_strdup(&scratch, pa->value);
+	      mesg = arena_printf(&scratch, "IP range, first IP and last IP blankspace separated:");
 	      rok = dialog_inputbox(title,
 				    mesg,
 				    22, 72,
 				    choosenvalue, 0);
-	      free(mesg);
 	      if ( rok == 0 ) {
-		put_aa(config, choosenkey, dialog_vars.input_result);
+		undo_begin(arena_printf(&scratch, "range of subnet %s", sn->network));
+		undo_subnet(config, sn->network);
+		param_put(config, &sn->params, pa->name, dialog_vars.input_result);
+		undo_commit(config);
+		check_warn(title, config, sn);
 #ifdef _DEBUG
 	      } else {
 		endwin();
@@ -980,28 +5985,28 @@ int main (int argc, char *argv[]) {
 		(void) initscr();
 #endif
 	      }
-	      free(choosenkey);
-	      free(choosenvalue);
-	      free_double_pointer(menu, menusz);
-	      free(key);
-	      goto startagain;
+#ifdef _DEBUG
+	    } else {
+	      endwin();
+	      printf("Canceled.");
+# ifndef _INFO
+	      printf("\n\nPress any key..."); getchar();
+# endif
+	      (void) initscr();
+#endif
 	    }
+	    goto startagain;
 	  }
-	} else {
-	  free(choosenkey);
+	}
 #ifdef _DEBUG
-	  endwin();
-	  printf("Canceled.");
+	endwin();
+	printf("Canceled.");
 # ifndef _INFO
-	  printf("\n\nPress any key..."); getchar();
+	printf("\n\nPress any key..."); getchar();
 # endif
-	  (void) initscr();
+	(void) initscr();
 #endif
-	  free_double_pointer(menu, menusz);
-	  free(key);
-	  goto startagain;
-	}
-
+	goto startagain;
       } else {
 #ifdef _DEBUG
 	endwin();
@@ -1011,30 +6016,45 @@ int main (int argc, char *argv[]) {
 # endif
 	(void) initscr();
 #endif
-	free_double_pointer(menu, menusz);
-	free(key);
 	goto startagain;
       }
-    } else if ( m_rex(dialog_vars.input_result, "Options", "") ) {
+    } else if ( m_crex(dialog_vars.input_result, "Find", "") ) {
+      /* Find host by MAC or IP */
+      menusz = 0;
+      menu = NULL;
+      rok = dialog_inputbox(title,
+			    "MAC or IP address of the host:",
+			    22, 72,
+			    "", 0);
+      if ( rok == 0 ) {
+	choosenkey = savestring(dialog_vars.input_result);
+	choosenkey = as_crex(choosenkey, "^ +| +$", "", "g");
+	if ( ( ho = host_find_mac(config, choosenkey, NULL) ) != NULL ||
+	     ( ho = host_find_ip(config, choosenkey, NULL) ) != NULL ) {
+	  undo_begin(arena_printf(&scratch, "host %s", ho->name));
+	  undo_host(config, ho->subnet->network, ho->name);
+	  edit_host(title, config, ho);
+	  undo_commit(config);
+	} else {
+	  mesg = arena_printf(&scratch, "\nThere is no host with %s reserved.\n", choosenkey);
+	  dialog_msgbox(title, mesg, 22, 72, true);
+	}
+	free(choosenkey);
+      }
+      goto startagain;
+    } else if ( m_crex(dialog_vars.input_result, "Options", "") ) {
       /* Global options */
-      free_double_pointer(menu, menusz);
       menusz = 0;
-      menu = xmalloc(sizeof(menu));
+      menu = arena_alloc(&scratch, sizeof(char *) * (2 * config->globals.count + 1));
 #ifdef _DEBUG
       endwin();
 #endif
-      for ( idx = 0; idx < k_lim; idx++ ) {
-	if ( ! m_rex(key[idx], "^subnet", "" ) ) {
-	  /* a little random problem here with allocation? */
-	  menu[menusz++] = savestring(key[idx]);
-	  menu[menusz-1] = as_rex(menu[menusz-1], ".*\\+", "", "g");
-	  menu = xrealloc(menu, sizeof(menu) * (menusz + 1));
-	  menu[menusz++] = savestring(get_aa(config, key[idx]));
-	  menu = xrealloc(menu, sizeof(menu) * (menusz + 1));
+      for ( pa = config->globals.first; pa != NULL; pa = pa->next ) {
+	menu[menusz++] = arena_strdup(&scratch, pa->name);
+	menu[menusz++] = arena_strdup(&scratch, pa->value);
 #if defined( _DEBUG ) && !defined( _INFO )
-	  printf("\n%s=%s", menu[menusz-2], menu[menusz-1]);
+	printf("\n%s=%s", menu[menusz-2], menu[menusz-1]);
 #endif
-	}
       }
 #ifdef _DEBUG
 # ifndef _INFO
@@ -1042,24 +6062,26 @@ int main (int argc, char *argv[]) {
 # endif
       (void) initscr();
 #endif
-      asprintf(&mesg, "Choose option to change:");
+      mesg = arena_printf(&scratch, "Choose option to change:");
       if (dialog_vars.input_result) dialog_vars.input_result[0] = '\0';
       rok = dialog_menu(title,
 			mesg,
 			22, 72, 17,
 			menusz / 2, menu);
-      free(mesg);
       if ( rok == 0 ) {
-	choosenkey = savestring(dialog_vars.input_result);
-	choosenvalue = savestring(get_aa(config, choosenkey));
-	asprintf(&mesg, "%s selected:", choosenkey);
+	choosenkey = arena_strdup(&scratch, dialog_vars.input_result);
+	pa = param_get(&config->globals, choosenkey);
+	choosenvalue = arena_strdup(&scratch, ( pa != NULL ) ? pa->value : "");
+	mesg = arena_printf(&scratch, "%s selected:", choosenkey);
 	rok = dialog_inputbox(title,
 			      mesg,
 			      22, 72,
 			      choosenvalue, 0);
-	free(mesg);
 	if ( rok == 0 ) {
-	  put_aa(config, choosenkey, dialog_vars.input_result);
+	  undo_begin(choosenkey);
+	  undo_globals(config);
+	  param_put(config, &config->globals, choosenkey, dialog_vars.input_result);
+	  undo_commit(config);
 #ifdef _DEBUG
 	} else {
 	  endwin();
@@ -1070,10 +6092,6 @@ int main (int argc, char *argv[]) {
 	  (void) initscr();
 #endif
 	}
-	free(choosenkey);
-	free(choosenvalue);
-	free_double_pointer(menu, menusz);
-	free(key);
 	goto startagain;
       } else {
 #ifdef _DEBUG
@@ -1084,56 +6102,83 @@ int main (int argc, char *argv[]) {
 # endif
 	(void) initscr();
 #endif
-	free_double_pointer(menu, menusz);
-	free(key);
 	goto startagain;
       }
-    } else if ( m_rex(dialog_vars.input_result, "Save", "") ) {
-      /* Save and exit */
-      if ( save_dhcpd_config(DEFCONFIG, config, k_lim, key) == 0 ) {
-	asprintf(&mesg,
-		 "\nConfiguration file was saved successfully, do not forget "
-		 "restart service to apply changes. If there is any problem "
-		 "you can recover backup file any time.\n\n"
-		 "Backup file format:\n\n%s-YYYYMMDD-HHMMSS\n\n"
-		 "Service restart example:\n\n"
-		 "root@example:~# service isc-dhcp-server restart\n",
-		 DEFCONFIG);
+    } else if ( m_crex(dialog_vars.input_result, "Undo", "") ) {
+      undo_back(config);
+      goto startagain;
+    } else if ( m_crex(dialog_vars.input_result, "Redo", "") ) {
+      undo_forth(config);
+      goto startagain;
+    } else if ( m_crex(dialog_vars.input_result, "Save", "") ) {
+      /* Save and exit, unless the user goes back to fix what dhcpd refuses */
+      watch_poll(title, config, DEFCONFIG);
+      if ( watch.conflicts > 0 ) {
+	rok = dialog_yesno(title, arena_printf(&scratch, "\nChanged on disk and here too, saving keeps "
+					       "your version of:\n\n%s\nSave anyway?\n", watch.text.data),
+			   22, 72);
+	watch_clear();
+	if ( rok != 0 )
+	  goto startagain;
+      }
+      memset(&cr, 0, sizeof(struct check_report));
+      if ( check_config(config, NULL, &cr) > 0 &&
+	   dialog_yesno(title, check_message(&cr, "Save anyway?"), 22, 72) != 0 ) {
+	ob_free(&cr.text);
+	goto startagain;
+      }
+      ob_free(&cr.text);
+      if ( review_changes(title, config) != 0 )
+	goto startagain;
+      if ( save_dhcpd_config(DEFCONFIG, config) == 0 ) {
+	mesg = arena_printf(&scratch,
+			    "\nConfiguration file was saved successfully, do not forget "
+			    "restart service to apply changes. If there is any problem "
+			    "you can recover backup file any time.\n\n"
+			    "Backups are kept in %s" STORE_SUFFIX "/ as links "
+			    DEFNAME "-YYYYMMDD-HHMMSS into " STORE_OBJECTS "/, "
+			    "use Restore to recover one.\n\n"
+			    "Service restart example:\n\n"
+			    "root@example:~# service isc-dhcp-server restart\n\n"
+			    "Backup %.3fs, render %.3fs, write %.3fs, fsync %.3fs, rename %.3fs\n",
+			    DEFCONFIG, last_save.backup, last_save.render,
+			    last_save.write, last_save.sync, last_save.rename);
 	dialog_msgbox(title, mesg, 22, 72, true);
-	free(mesg);
 	endwin();
       } else {
-	asprintf(&mesg,
-		 "\nSomething went wrong, cannot save dhcpd.conf file. "
-		 "Please review the error and try again later.\n\n"
-		 "Error number: %i\n\nDescription:\n\n%s\n",
-		 errno, strerror(errno));
+	mesg = arena_printf(&scratch,
+			    "\nSomething went wrong, cannot save dhcpd.conf file. "
+			    "Please review the error and try again later.\n\n"
+			    "Error number: %i\n\nDescription:\n\n%s\n",
+			    errno, strerror(errno));
 	dialog_msgbox(title, mesg, 22, 72, true);
-	free(mesg);
-	free(key);
 	goto startagain;
       }
-    } else if ( m_rex(dialog_vars.input_result, "Restore", "") ) {
-      /* Restore previous config */
-      free_double_pointer(menu, menusz);
-      menusz = 0;
-      menu = lsbkdir_fast_menu(&menusz);
-      asprintf(&mesg, "Choose backup file to recover by date:");
-      if (dialog_vars.input_result) dialog_vars.input_result[0] = '\0';
-      rok = dialog_menu(title,
-			mesg,
-			22, 72, 17,
-			menusz / 2, menu);
-      free(mesg);
+    } else if ( m_crex(dialog_vars.input_result, "Restore", "") ) {
+      /* Restore previous config, a page of the catalog at a time */
+      mesg = arena_printf(&scratch, "Choose backup file to recover by date:");
+      for ( i = 0; ; ) {
+	menu = catalog_fast_menu(&menusz, i);
+	if (dialog_vars.input_result) dialog_vars.input_result[0] = '\0';
+	rok = dialog_menu(title,
+			  mesg,
+			  22, 72, 17,
+			  menusz / 2, menu);
+	if ( rok == 0 && strcmp(dialog_vars.input_result, "Older") == 0 )
+	  i++;
+	else if ( rok == 0 && strcmp(dialog_vars.input_result, "Newer") == 0 )
+	  i--;
+	else
+	  break;
+      }
       if ( rok == 0 ) {
 	choosenkey = savestring(dialog_vars.input_result);
-	choosenkey = as_rex(choosenkey, "^", DEFPATH, "");
-	destroy_aa(config);
+	choosenkey = as_crex(choosenkey, "^", DEFPATH, "");
+	destroy_conf(config);
 	config = get_dhcpd_config(choosenkey);
+	undo_reset();
 	free(choosenkey);
       }
-      free_double_pointer(menu, menusz);
-      free(key);
       goto startagain;
     }
   } else {
@@ -1142,8 +6187,16 @@ int main (int argc, char *argv[]) {
     printf("Canceled.\n");
 #endif
   }
-  free_double_pointer(menu, menusz);
-  free(key);
-  destroy_aa(config);
+  destroy_conf(config);
+#ifdef _DEBUG
+  crex_stats(&crex_hits, &crex_misses);
+  printf("Pattern cache: %li hits, %li misses.\n", crex_hits, crex_misses);
+  printf("Scratch arena: %li allocations, %zu bytes peak since start.\n", scratch.total_allocs,
+	 scratch.peak_bytes);
+#endif
+  crex_free();
+  file_cache_free();
+  arena_free(&scratch);
   exit (EXIT_SUCCESS);
 }
+#endif